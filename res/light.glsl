@@ -1,3 +1,5 @@
+#extension GL_ARB_uniform_buffer_object : require
+
 struct directional
 {
 	vec3 ambient;
@@ -110,14 +112,18 @@ void shade_spot(spot light, inout vec3 ambient, inout vec3 diffuse, inout vec3 s
 	specular += light.specular*power_factor*att;
 }
 
-uniform directional dlights[4];
-uniform int num_dlights;
-
-uniform point plights[4];
-uniform int num_plights;
+// Filled once per frame by scenehdl::upload_lights. The layout
+// has to match lightblockhdl in src/light.h.
+layout(std140) uniform lights
+{
+	int num_dlights;
+	int num_plights;
+	int num_slights;
 
-uniform spot slights[4];
-uniform int num_slights;
+	directional dlights[4];
+	point plights[4];
+	spot slights[4];
+};
 
 vec3 lighting(vec3 emission, vec3 ambient, vec3 diffuse, vec3 specular, float shininess, vec3 vertex, vec3 normal)
 {
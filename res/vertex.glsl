@@ -0,0 +1,58 @@
+uniform bool packed_vertices;
+uniform bool instanced;
+
+uniform vec3 position_scale;
+uniform vec3 position_offset;
+uniform vec2 texcoord_scale;
+uniform vec2 texcoord_offset;
+
+// Packed vertices (see rigidhdl::pack) arrive as 16 bit integers.
+// Positions and texture coordinates are mapped back onto the range
+// of the mesh, and normals are unfolded from an octahedron.
+vec4 vertex_position()
+{
+	if (packed_vertices)
+		return vec4(gl_Vertex.xyz*position_scale + position_offset, 1.0);
+	return gl_Vertex;
+}
+
+vec3 vertex_normal()
+{
+	if (!packed_vertices)
+		return gl_Normal;
+
+	vec3 normal = vec3(gl_Normal.xy, 1.0 - abs(gl_Normal.x) - abs(gl_Normal.y));
+	if (normal.z < 0.0)
+	{
+		vec2 signs = vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+		normal.xy = (1.0 - abs(normal.yx))*signs;
+	}
+	return normalize(normal);
+}
+
+vec2 vertex_texcoord()
+{
+	if (packed_vertices)
+		return gl_MultiTexCoord0.xy*texcoord_scale + texcoord_offset;
+	return gl_MultiTexCoord0.xy;
+}
+
+// Instanced draws (see queuehdl::submit) give each instance its
+// own modelview matrix instead of using the built in one. It only
+// ever holds rotations, uniform scales and translations, so it
+// can transform normals as well.
+attribute mat4 instance_modelview;
+
+mat4 modelview_matrix()
+{
+	if (instanced)
+		return instance_modelview;
+	return gl_ModelViewMatrix;
+}
+
+mat3 normal_matrix()
+{
+	if (instanced)
+		return mat3(instance_modelview[0].xyz, instance_modelview[1].xyz, instance_modelview[2].xyz);
+	return gl_NormalMatrix;
+}
@@ -0,0 +1,524 @@
+/*
+ * bvh.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "bvh.h"
+#include <algorithm>
+
+packethdl::packethdl()
+{
+	count = 0;
+}
+
+/* add
+ *
+ * Add a ray from 'origin' along 'direction' that ends at 't'.
+ */
+void packethdl::add(const vec3f &origin, const vec3f &direction, float t)
+{
+	if (count >= size)
+		return;
+
+	for (int j = 0; j < 3; j++)
+	{
+		this->origin[j][count] = origin[j];
+		this->direction[j][count] = direction[j];
+	}
+	this->t[count] = t;
+	object[count] = -1;
+	triangle[count] = -1;
+	u[count] = 0.0f;
+	v[count] = 0.0f;
+	count++;
+}
+
+/* update_inverse
+ *
+ * Compute one over every component of the directions for the slab
+ * tests. Zeros are nudged away from zero so that the slab tests
+ * never multiply infinity by zero.
+ */
+void packethdl::update_inverse()
+{
+	for (int j = 0; j < 3; j++)
+		for (int i = 0; i < count; i++)
+		{
+			float d = direction[j][i];
+			if (fabs(d) < 1.0e-20f)
+				d = (d < 0.0f ? -1.0e-20f : 1.0e-20f);
+			inverse[j][i] = 1.0f/d;
+		}
+}
+
+/* transform
+ *
+ * Move every ray by the affine transform 'm'. The points along each
+ * ray keep their 't', so hits found afterwards are still comparable
+ * to the ones found before.
+ */
+void packethdl::transform(const mat4f &m)
+{
+	for (int i = 0; i < count; i++)
+	{
+		float o[3], d[3];
+		for (int j = 0; j < 3; j++)
+		{
+			o[j] = m[j][0]*origin[0][i] + m[j][1]*origin[1][i] + m[j][2]*origin[2][i] + m[j][3];
+			d[j] = m[j][0]*direction[0][i] + m[j][1]*direction[1][i] + m[j][2]*direction[2][i];
+		}
+
+		for (int j = 0; j < 3; j++)
+		{
+			origin[j][i] = o[j];
+			direction[j][i] = d[j];
+		}
+	}
+	update_inverse();
+}
+
+bvhhdl::bvhhdl()
+{
+	fingerprint = 0;
+}
+
+bvhhdl::~bvhhdl()
+{
+}
+
+/* area
+ *
+ * Half of the surface area of a box, which is all the surface
+ * area heuristic needs.
+ */
+static float area(const float *low, const float *high)
+{
+	float x = high[0] - low[0], y = high[1] - low[1], z = high[2] - low[2];
+	if (x < 0.0f || y < 0.0f || z < 0.0f)
+		return 0.0f;
+	return x*y + y*z + z*x;
+}
+
+static void grow(float *low, float *high, const vec6f &b)
+{
+	for (int j = 0; j < 3; j++)
+	{
+		low[j] = min(low[j], b[2*j]);
+		high[j] = max(high[j], b[2*j+1]);
+	}
+}
+
+static void reset(float *low, float *high)
+{
+	for (int j = 0; j < 3; j++)
+	{
+		low[j] = 1.0e30f;
+		high[j] = -1.0e30f;
+	}
+}
+
+/* subdivide
+ *
+ * Fill in the bounds of 'node', which covers the primitives from
+ * 'first' to 'first'+'count' in 'order', and split it in two with
+ * binned SAH. The centers of the primitives are dropped into 'bins'
+ * buckets along each axis, and the boundary between buckets that
+ * gives the cheapest pair of children is taken. Deep trees fall back
+ * on splitting in the middle of the list so that traversal never
+ * needs a big stack.
+ */
+static void subdivide(vector<bvhnodehdl> &nodes, vector<int> &order, const vector<vec6f> &bounds, const vector<vec3f> &centers, int node, int first, int count, int depth)
+{
+	float low[3], high[3], center_low[3], center_high[3];
+	reset(low, high);
+	reset(center_low, center_high);
+	for (int i = first; i < first + count; i++)
+	{
+		grow(low, high, bounds[order[i]]);
+		const vec3f &c = centers[order[i]];
+		for (int j = 0; j < 3; j++)
+		{
+			center_low[j] = min(center_low[j], c[j]);
+			center_high[j] = max(center_high[j], c[j]);
+		}
+	}
+
+	for (int j = 0; j < 3; j++)
+	{
+		nodes[node].low[j] = low[j];
+		nodes[node].high[j] = high[j];
+	}
+	nodes[node].first = first;
+	nodes[node].count = count;
+	nodes[node].axis = 0;
+
+	if (count <= 2)
+		return;
+
+	float best_cost = 1.0e30f;
+	int best_axis = -1, best_split = 0;
+	if (depth < 48)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = center_high[axis] - center_low[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			int bin_count[bvhhdl::bins];
+			float bin_low[bvhhdl::bins][3], bin_high[bvhhdl::bins][3];
+			for (int b = 0; b < bvhhdl::bins; b++)
+			{
+				bin_count[b] = 0;
+				reset(bin_low[b], bin_high[b]);
+			}
+
+			float scale = (float)bvhhdl::bins/extent;
+			for (int i = first; i < first + count; i++)
+			{
+				int b = min(bvhhdl::bins-1, (int)((centers[order[i]][axis] - center_low[axis])*scale));
+				bin_count[b]++;
+				grow(bin_low[b], bin_high[b], bounds[order[i]]);
+			}
+
+			// Sweep from the right to get the cost of everything past
+			// each boundary, then from the left to finish it.
+			float right_area[bvhhdl::bins];
+			int right_count[bvhhdl::bins];
+			float l[3], h[3];
+			reset(l, h);
+			int n = 0;
+			for (int b = bvhhdl::bins-1; b > 0; b--)
+			{
+				n += bin_count[b];
+				for (int j = 0; j < 3; j++)
+				{
+					l[j] = min(l[j], bin_low[b][j]);
+					h[j] = max(h[j], bin_high[b][j]);
+				}
+				right_area[b] = area(l, h);
+				right_count[b] = n;
+			}
+
+			reset(l, h);
+			n = 0;
+			for (int b = 0; b < bvhhdl::bins-1; b++)
+			{
+				n += bin_count[b];
+				for (int j = 0; j < 3; j++)
+				{
+					l[j] = min(l[j], bin_low[b][j]);
+					h[j] = max(h[j], bin_high[b][j]);
+				}
+
+				if (n == 0 || right_count[b+1] == 0)
+					continue;
+
+				float cost = area(l, h)*(float)n + right_area[b+1]*(float)right_count[b+1];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b+1;
+				}
+			}
+		}
+	}
+
+	// A leaf costs one intersection per primitive and a split costs
+	// about one intersection to visit plus the children.
+	float parent_area = area(low, high);
+	if (count <= bvhhdl::max_leaf_size && (best_axis < 0 || 1.0f + best_cost/max(parent_area, 1.0e-30f) >= (float)count))
+		return;
+
+	int middle = first + count/2;
+	if (best_axis >= 0)
+	{
+		float scale = (float)bvhhdl::bins/(center_high[best_axis] - center_low[best_axis]);
+		float split_low = center_low[best_axis];
+		int axis = best_axis, split = best_split;
+		middle = (int)(partition(order.begin() + first, order.begin() + first + count, [&](int p) {
+			return min(bvhhdl::bins-1, (int)((centers[p][axis] - split_low)*scale)) < split;
+		}) - order.begin());
+
+		if (middle == first || middle == first + count)
+			middle = first + count/2;
+	}
+	else
+	{
+		// Everything has the same center, or the tree is too deep.
+		int axis = 0;
+		for (int j = 1; j < 3; j++)
+			if (center_high[j] - center_low[j] > center_high[axis] - center_low[axis])
+				axis = j;
+		best_axis = axis;
+		nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&](int a, int b) {
+			return centers[a][axis] < centers[b][axis];
+		});
+	}
+
+	int child = (int)nodes.size();
+	nodes.push_back(bvhnodehdl());
+	nodes.push_back(bvhnodehdl());
+	nodes[node].first = child;
+	nodes[node].count = 0;
+	nodes[node].axis = best_axis;
+
+	subdivide(nodes, order, bounds, centers, child, first, middle - first, depth+1);
+	subdivide(nodes, order, bounds, centers, child+1, middle, first + count - middle, depth+1);
+}
+
+/* build
+ *
+ * Build the hierarchy over the primitives with the given bounds.
+ * Primitive i is 'i' in traverse() and in the orders of the leaves.
+ */
+void bvhhdl::build(const vector<vec6f> &bounds)
+{
+	clear();
+	if (bounds.size() == 0)
+		return;
+
+	vector<vec3f> centers(bounds.size());
+	order.resize(bounds.size());
+	for (unsigned int i = 0; i < bounds.size(); i++)
+	{
+		order[i] = i;
+		centers[i] = vec3f((bounds[i][0] + bounds[i][1])*0.5f, (bounds[i][2] + bounds[i][3])*0.5f, (bounds[i][4] + bounds[i][5])*0.5f);
+	}
+
+	nodes.reserve(bounds.size()*2);
+	nodes.push_back(bvhnodehdl());
+	subdivide(nodes, order, bounds, centers, 0, 0, (int)bounds.size(), 0);
+}
+
+void bvhhdl::clear()
+{
+	nodes.clear();
+	order.clear();
+	fingerprint = 0;
+}
+
+/* bound
+ *
+ * Get the bounding box of everything in the hierarchy, which is
+ * empty (left > right) if there is nothing in it.
+ */
+vec6f bvhhdl::bound() const
+{
+	if (nodes.size() == 0)
+		return vec6f(1.0e6, -1.0e6, 1.0e6, -1.0e6, 1.0e6, -1.0e6);
+
+	const bvhnodehdl &root = nodes[0];
+	return vec6f(root.low[0], root.high[0], root.low[1], root.high[1], root.low[2], root.high[2]);
+}
+
+/* overlaps
+ *
+ * Check whether any ray of the packet passes through the box of
+ * 'node' before its nearest hit so far.
+ */
+static bool overlaps(const bvhnodehdl &node, const packethdl &packet)
+{
+	for (int i = 0; i < packet.count; i++)
+	{
+		float near = 0.0f, far = packet.t[i];
+		for (int j = 0; j < 3; j++)
+		{
+			float t0 = (node.low[j] - packet.origin[j][i])*packet.inverse[j][i];
+			float t1 = (node.high[j] - packet.origin[j][i])*packet.inverse[j][i];
+			near = max(near, min(t0, t1));
+			far = min(far, max(t0, t1));
+		}
+
+		// Neighboring rays usually agree, so the first one that
+		// gets through settles it most of the time.
+		if (near <= far)
+			return true;
+	}
+	return false;
+}
+
+/* walk
+ *
+ * Go through the nodes of 'bvh' that the packet passes through, near
+ * child first, and call visit(first, count) for the primitives in
+ * each leaf that is reached.
+ */
+template <class visitor>
+static void walk(const bvhhdl &bvh, packethdl &packet, const visitor &visit)
+{
+	if (bvh.nodes.size() == 0 || packet.count == 0)
+		return;
+
+	int stack[128];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const bvhnodehdl &node = bvh.nodes[stack[--top]];
+		if (!overlaps(node, packet))
+			continue;
+
+		if (node.count > 0)
+			visit(node.first, node.count);
+		else if (packet.direction[node.axis][0] < 0.0f)
+		{
+			stack[top++] = node.first;
+			stack[top++] = node.first+1;
+		}
+		else
+		{
+			stack[top++] = node.first+1;
+			stack[top++] = node.first;
+		}
+	}
+}
+
+/* intersect
+ *
+ * Find the nearest hit of every ray of the packet with the triangles
+ * of a mesh, given that this was built over them. Rays that hit one
+ * closer than their 't' get their 't' moved to the hit, 'object' set
+ * to 'object', and 'triangle', 'u' and 'v' set to the triangle and the
+ * barycentric coordinates of the hit within it.
+ */
+void bvhhdl::intersect(packethdl &packet, const vector<vec8f> &geometry, const vector<int> &indices, int object) const
+{
+	walk(*this, packet, [&](int first, int count) {
+		for (int k = first; k < first + count; k++)
+		{
+			int triangle = order[k];
+			const vec8f &p0 = geometry[indices[triangle*3 + 0]];
+			const vec8f &p1 = geometry[indices[triangle*3 + 1]];
+			const vec8f &p2 = geometry[indices[triangle*3 + 2]];
+			float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+			// Moller-Trumbore
+			for (int i = 0; i < packet.count; i++)
+			{
+				float d[3] = {packet.direction[0][i], packet.direction[1][i], packet.direction[2][i]};
+				float p[3] = {d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0]};
+				float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+				if (det == 0.0f)
+					continue;
+
+				float inv_det = 1.0f/det;
+				float s[3] = {packet.origin[0][i] - p0[0], packet.origin[1][i] - p0[1], packet.origin[2][i] - p0[2]};
+				float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2])*inv_det;
+				if (u < 0.0f || u > 1.0f)
+					continue;
+
+				float q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+				float v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2])*inv_det;
+				if (v < 0.0f || u + v > 1.0f)
+					continue;
+
+				float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2])*inv_det;
+				if (t >= 0.0f && t < packet.t[i])
+				{
+					packet.t[i] = t;
+					packet.object[i] = object;
+					packet.triangle[i] = triangle;
+					packet.u[i] = u;
+					packet.v[i] = v;
+				}
+			}
+		}
+	});
+}
+
+/* traverse
+ *
+ * Call visit(i) for every primitive i in a leaf that some ray of
+ * the packet reaches, nearest leaves first. The visitor is expected
+ * to shorten the rays that it hits, which prunes the rest of the
+ * traversal.
+ */
+void bvhhdl::traverse(packethdl &packet, const function<void(int)> &visit) const
+{
+	walk(*this, packet, [&](int first, int count) {
+		for (int k = first; k < first + count; k++)
+			visit(order[k]);
+	});
+}
+
+/* transform_bound
+ *
+ * Find the bounding box of the box 'b' after it is moved by the
+ * affine transform 'm'.
+ */
+vec6f transform_bound(const mat4f &m, const vec6f &b)
+{
+	vec6f result(1.0e30f, -1.0e30f, 1.0e30f, -1.0e30f, 1.0e30f, -1.0e30f);
+	for (int c = 0; c < 8; c++)
+	{
+		float p[3] = {b[(c&1) ? 1 : 0], b[(c&2) ? 3 : 2], b[(c&4) ? 5 : 4]};
+		for (int i = 0; i < 3; i++)
+		{
+			float e = m[i][0]*p[0] + m[i][1]*p[1] + m[i][2]*p[2] + m[i][3];
+			result[2*i] = min(result[2*i], e);
+			result[2*i+1] = max(result[2*i+1], e);
+		}
+	}
+	return result;
+}
+
+/* affine_inverse
+ *
+ * Invert a transform made of rotations, uniform scales and
+ * translations, like the world and modelview matrices of objects.
+ * The inverse is the transpose divided by the squared scale. A
+ * transform that scales everything down to a point has no inverse,
+ * so this returns false and leaves 'result' as the identity.
+ */
+bool affine_inverse(const mat4f &m, mat4f &result)
+{
+	result = identity<float, 4, 4>();
+	float s2 = m[0][0]*m[0][0] + m[1][0]*m[1][0] + m[2][0]*m[2][0];
+	if (s2 == 0.0f)
+		return false;
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			result[i][j] = m[j][i]/s2;
+		result[i][3] = -(result[i][0]*m[0][3] + result[i][1]*m[1][3] + result[i][2]*m[2][3]);
+	}
+	return true;
+}
+
+/* unproject
+ *
+ * Find the eye space point that the projection matrix 'p' maps to
+ * (x, y, z) in normalized device coordinates. Each coordinate gives
+ * a plane through the point, (p[i] - x*p[3]).e = 0, and the point is
+ * where the three of them meet.
+ */
+vec3f unproject(const mat4f &p, float x, float y, float z)
+{
+	float ndc[3] = {x, y, z};
+	float a[3][4];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 4; j++)
+			a[i][j] = p[i][j] - ndc[i]*p[3][j];
+
+	// Cramer's rule on a*(ex, ey, ez) = -a[][3]
+	float det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1]) - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0]) + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+	if (det == 0.0f)
+		return vec3f(0.0f, 0.0f, 0.0f);
+
+	vec3f result;
+	for (int k = 0; k < 3; k++)
+	{
+		float m[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				m[i][j] = (j == k ? -a[i][3] : a[i][j]);
+		result[k] = (m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1]) - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0]) + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]))/det;
+	}
+	return result;
+}
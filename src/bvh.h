@@ -0,0 +1,101 @@
+/*
+ * bvh.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include <functional>
+
+using namespace core;
+
+#ifndef bvh_h
+#define bvh_h
+
+/* A group of rays that are traced together. Rays that start close
+ * together and point the same way, like the primary rays of a small
+ * block of pixels, mostly visit the same nodes, so going through the
+ * hierarchy once for all of them saves most of the traversal.
+ *
+ * 't' starts out as the far end of each ray and shrinks to the
+ * nearest hit, a point on the ray is origin + t*direction. 'object'
+ * is -1 for rays that haven't hit anything yet.
+ */
+struct packethdl
+{
+	enum
+	{
+		size = 16
+	};
+
+	packethdl();
+
+	int count;
+	float origin[3][size];
+	float direction[3][size];
+	float inverse[3][size];
+	float t[size];
+
+	int object[size];
+	int triangle[size];
+	float u[size], v[size];
+
+	void add(const vec3f &origin, const vec3f &direction, float t);
+	void update_inverse();
+	void transform(const mat4f &m);
+};
+
+/* A node of bvhhdl. Leaves list 'count' primitives starting at
+ * 'first' in bvhhdl::order. Interior nodes have a count of zero and
+ * their children at 'first' and 'first'+1, split along 'axis'.
+ */
+struct bvhnodehdl
+{
+	float low[3];
+	float high[3];
+	int first;
+	int count;
+	int axis;
+};
+
+/* A bounding volume hierarchy over a list of primitives given by
+ * their bounding boxes, built with the surface area heuristic. The
+ * mesh of every rigid body keeps one over its triangles, see
+ * meshhdl::update_bvh, and renderers and picking build one over the
+ * rigid bodies of the scene.
+ */
+struct bvhhdl
+{
+	bvhhdl();
+	~bvhhdl();
+
+	enum
+	{
+		max_leaf_size = 8,
+		bins = 12
+	};
+
+	vector<bvhnodehdl> nodes;
+	vector<int> order;
+
+	// The fingerprint of the mesh that this was built from, see
+	// meshhdl::hash().
+	unsigned long long fingerprint;
+
+	// Bounding boxes are (left, right, bottom, top, front, back)
+	// like objecthdl::bound.
+	void build(const vector<vec6f> &bounds);
+	void clear();
+	vec6f bound() const;
+
+	void intersect(packethdl &packet, const vector<vec8f> &geometry, const vector<int> &indices, int object) const;
+	void traverse(packethdl &packet, const function<void(int)> &visit) const;
+};
+
+vec6f transform_bound(const mat4f &m, const vec6f &b);
+bool affine_inverse(const mat4f &m, mat4f &result);
+vec3f unproject(const mat4f &p, float x, float y, float z);
+
+#endif
@@ -16,6 +16,8 @@ camerahdl::camerahdl()
 	type = "camera";
 	focus = NULL;
 	radius = 10.0f;
+	view_matrix = identity<float, 4, 4>();
+	projection_matrix = identity<float, 4, 4>();
 }
 
 camerahdl::~camerahdl()
@@ -23,34 +25,94 @@ camerahdl::~camerahdl()
 
 }
 
-void camerahdl::view()
+/* update_view
+ *
+ * Compute the world to eye space transform on the CPU, so that
+ * the lights and objects can use it without reading it back from
+ * OpenGL.
+ */
+void camerahdl::update_view()
 {
-	glLoadIdentity();
-
+	vec3f x, y, z;
 	if (focus == NULL)
 	{
-        glRotatef(radtodeg(-model->orientation[0]), 1.0, 0.0, 0.0);
-        glRotatef(radtodeg(-model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(-model->orientation[2]), 0.0, 0.0, 1.0);
-        glTranslatef(-position[0], -position[1], -position[2]);
+		// The inverse of the model's rotation, which is
+		// the rotations around z, y, then x by the
+		// negated angles.
+		x = rol3(vec3f(1.0, 0.0, 0.0), -model->orientation);
+		y = rol3(vec3f(0.0, 1.0, 0.0), -model->orientation);
+		z = rol3(vec3f(0.0, 0.0, 1.0), -model->orientation);
+
+		view_matrix = identity<float, 4, 4>();
+		for (int i = 0; i < 3; i++)
+		{
+			view_matrix[i][0] = x[i];
+			view_matrix[i][1] = y[i];
+			view_matrix[i][2] = z[i];
+		}
 	}
 	else
 	{
-		position = focus->position + ror3(vec3f(0.0, 0.0, radius), orientation);
-	    vec3f up = ror3(vec3f(0.0, 1.0, 0.0), orientation);
-        gluLookAt(position[0], position[1], position[2],
-                  focus->position[0], focus->position[1], focus->position[2],
-                  up[0], up[1], up[2]);
+		// The same matrix as gluLookAt
+		const mat4f &target = focus->world_matrix();
+		vec3f center(target[0][3], target[1][3], target[2][3]);
+		position = center + ror3(vec3f(0.0, 0.0, radius), orientation);
+		vec3f up = ror3(vec3f(0.0, 1.0, 0.0), orientation);
+		vec3f forward = norm(center - position);
+		vec3f side = norm(cross(forward, up));
+		up = cross(side, forward);
+
+		view_matrix = identity<float, 4, 4>();
+		for (int i = 0; i < 3; i++)
+		{
+			view_matrix[0][i] = side[i];
+			view_matrix[1][i] = up[i];
+			view_matrix[2][i] = -forward[i];
+		}
 	}
 
+	for (int i = 0; i < 3; i++)
+		view_matrix[i][3] = -(view_matrix[i][0]*position[0] + view_matrix[i][1]*position[1] + view_matrix[i][2]*position[2]);
+
+	// A camera that is attached to another object is placed
+	// relative to it.
+	if (focus == NULL && model != NULL && model->parent != NULL)
+		view_matrix = view_matrix*model->parent->world_inverse();
+
 	if (model != NULL)
 	{
 		model->position = position;
 		model->orientation = orientation;
 		model->orientation[0] *= -1;
+
+		// Anything attached to the model follows the camera this frame.
+		model->update();
 	}
 }
 
+/* view
+ *
+ * Update the view matrix and load it as the modelview matrix.
+ */
+void camerahdl::view()
+{
+	update_view();
+	glLoadTransposeMatrixf((float*)view_matrix.data);
+}
+
+/* project
+ *
+ * Update the projection matrix and load it.
+ */
+void camerahdl::project()
+{
+	update_projection();
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadTransposeMatrixf((float*)projection_matrix.data);
+	glMatrixMode(GL_MODELVIEW);
+}
+
 orthohdl::orthohdl()
 {
 	left = -10.0;
@@ -66,12 +128,19 @@ orthohdl::~orthohdl()
 {
 }
 
-void orthohdl::project()
+/* update_projection
+ *
+ * Build the same matrix as glOrtho.
+ */
+void orthohdl::update_projection()
 {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(left, right, bottom, top, front, back);
-    glMatrixMode(GL_MODELVIEW);
+	projection_matrix = identity<float, 4, 4>();
+	projection_matrix[0][0] = 2.0f/(right - left);
+	projection_matrix[0][3] = -(right + left)/(right - left);
+	projection_matrix[1][1] = 2.0f/(top - bottom);
+	projection_matrix[1][3] = -(top + bottom)/(top - bottom);
+	projection_matrix[2][2] = -2.0f/(back - front);
+	projection_matrix[2][3] = -(back + front)/(back - front);
 }
 
 frustumhdl::frustumhdl()
@@ -90,12 +159,21 @@ frustumhdl::~frustumhdl()
 
 }
 
-void frustumhdl::project()
+/* update_projection
+ *
+ * Build the same matrix as glFrustum.
+ */
+void frustumhdl::update_projection()
 {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glFrustum(left, right, bottom, top, front, back);
-    glMatrixMode(GL_MODELVIEW);
+	projection_matrix = identity<float, 4, 4>();
+	projection_matrix[0][0] = 2.0f*front/(right - left);
+	projection_matrix[0][2] = (right + left)/(right - left);
+	projection_matrix[1][1] = 2.0f*front/(top - bottom);
+	projection_matrix[1][2] = (top + bottom)/(top - bottom);
+	projection_matrix[2][2] = -(back + front)/(back - front);
+	projection_matrix[2][3] = -2.0f*back*front/(back - front);
+	projection_matrix[3][2] = -1.0f;
+	projection_matrix[3][3] = 0.0f;
 }
 
 perspectivehdl::perspectivehdl()
@@ -112,10 +190,20 @@ perspectivehdl::~perspectivehdl()
 
 }
 
-void perspectivehdl::project()
+/* update_projection
+ *
+ * Build the same matrix as gluPerspective, which takes fovy
+ * in degrees.
+ */
+void perspectivehdl::update_projection()
 {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(fovy, aspect, front, back);
-    glMatrixMode(GL_MODELVIEW);
+	float f = 1.0f/tan(fovy*m_pi/360.0);
+
+	projection_matrix = identity<float, 4, 4>();
+	projection_matrix[0][0] = f/aspect;
+	projection_matrix[1][1] = f;
+	projection_matrix[2][2] = (back + front)/(front - back);
+	projection_matrix[2][3] = 2.0f*back*front/(front - back);
+	projection_matrix[3][2] = -1.0f;
+	projection_matrix[3][3] = 0.0f;
 }
@@ -29,7 +29,20 @@ struct camerahdl
 	objecthdl *focus;
 	float radius;
 
-	virtual void project() = 0;
+	// The world to eye space transform that view() loads
+	// into the modelview matrix, in row major order.
+	mat4f view_matrix;
+
+	// The eye to clip space transform that project() loads
+	// into the projection matrix, in row major order.
+	mat4f projection_matrix;
+
+	// These only compute the matrices, so they work without
+	// an OpenGL context.
+	void update_view();
+	virtual void update_projection() = 0;
+
+	void project();
 	void view();
 };
 
@@ -40,7 +53,7 @@ struct orthohdl : camerahdl
 
 	float left, right, bottom, top, front, back;
 
-	void project();
+	void update_projection();
 };
 
 struct frustumhdl : camerahdl
@@ -50,7 +63,7 @@ struct frustumhdl : camerahdl
 
 	float left, right, bottom, top, front, back;
 
-	void project();
+	void update_projection();
 };
 
 struct perspectivehdl : camerahdl
@@ -60,7 +73,7 @@ struct perspectivehdl : camerahdl
 
 	float fovy, aspect, front, back;
 
-	void project();
+	void update_projection();
 };
 
 #endif
@@ -0,0 +1,815 @@
+/*
+ * canvas.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "canvas.h"
+#include "scene.h"
+#include "camera.h"
+#include "object.h"
+#include "material.h"
+#include "pool.h"
+#include "lodepng.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+extern string working_directory;
+
+/* How far past the edges of the screen, in pixels, triangles may
+ * reach before they are clipped. Clipping is slow, but it's only
+ * needed for the few triangles that stick out this far. This also
+ * keeps the fixed point coordinates small enough that the edge
+ * functions stay within 32 bits inside of a block.
+ */
+static const float guard_band = 2048.0f;
+
+canvashdl::canvashdl()
+{
+	width = 0;
+	height = 0;
+	tiles_wide = 0;
+	tiles_high = 0;
+	stride = 0;
+	rows = 0;
+	projection = identity<float, 4, 4>();
+	memset(&lights, 0, sizeof(lights));
+	texture_width = 0;
+	texture_height = 0;
+	triangle_count = 0;
+}
+
+canvashdl::~canvashdl()
+{
+}
+
+/* resize
+ *
+ * Reallocate the buffers for a 'width' by 'height' image. Larger
+ * images than max_size are clamped to it, so check 'width' and
+ * 'height' afterwards or reject such sizes before.
+ */
+void canvashdl::resize(int width, int height)
+{
+	this->width = min(max(width, 1), (int)max_size);
+	this->height = min(max(height, 1), (int)max_size);
+	tiles_wide = (this->width + tile_size - 1)/tile_size;
+	tiles_high = (this->height + tile_size - 1)/tile_size;
+	stride = (this->width + block_size - 1)/block_size*block_size;
+	rows = (this->height + block_size - 1)/block_size*block_size;
+
+	color.assign(stride*rows*4, 0);
+	depth.assign(stride*rows, 1.0f);
+	hiz.assign((stride/block_size)*(rows/block_size), 1.0f);
+}
+
+/* clear
+ *
+ * Fill the image with 'background' and reset the depth to the far
+ * plane, like glClear.
+ */
+void canvashdl::clear(vec3f background)
+{
+	unsigned char value[4];
+	for (int i = 0; i < 3; i++)
+		value[i] = (unsigned char)(core::clamp(background[i], 0.0f, 1.0f)*255.0f + 0.5f);
+	value[3] = 255;
+
+	for (int i = 0; i < stride*rows; i++)
+		memcpy(&color[i*4], value, 4);
+	fill(depth.begin(), depth.end(), 1.0f);
+	fill(hiz.begin(), hiz.end(), 1.0f);
+}
+
+/* set_material
+ *
+ * Work out how to shade a material, and copy the uniforms that its
+ * shaders would get. Texture and custom materials only use shininess,
+ * and white only the color in res/white.ft. Returns the shading, which
+ * is shade_none for materials that can't be drawn.
+ */
+int canvasdrawhdl::set_material(const materialhdl *material)
+{
+	emission = vec3f(0.0f, 0.0f, 0.0f);
+	ambient = vec3f(0.0f, 0.0f, 0.0f);
+	diffuse = vec3f(0.0f, 0.0f, 0.0f);
+	specular = vec3f(0.0f, 0.0f, 0.0f);
+	shininess = 1.0f;
+	shading = canvashdl::shade_none;
+
+	if (material == NULL)
+		return shading;
+
+	if (material->type == "white")
+	{
+		emission = vec3f(1.0f, 0.0f, 0.0f);
+		shading = canvashdl::shade_solid;
+	}
+	else if (material->type == "gouraud")
+	{
+		const gouraudhdl *g = (const gouraudhdl*)material;
+		emission = g->emission;
+		ambient = g->ambient;
+		diffuse = g->diffuse;
+		specular = g->specular;
+		shininess = g->shininess;
+		shading = canvashdl::shade_gouraud;
+	}
+	else if (material->type == "phong")
+	{
+		const phonghdl *p = (const phonghdl*)material;
+		emission = p->emission;
+		ambient = p->ambient;
+		diffuse = p->diffuse;
+		specular = p->specular;
+		shininess = p->shininess;
+		shading = canvashdl::shade_phong;
+	}
+	else if (material->type == "custom")
+		shading = canvashdl::shade_custom;
+	else if (material->type == "texture")
+	{
+		shininess = ((const texturehdl*)material)->shininess;
+		shading = canvashdl::shade_texture;
+	}
+
+	return shading;
+}
+
+/* begin
+ *
+ * Get ready to draw a frame of the scene. This updates the scene's
+ * tree and the matrices of the active camera and the lights without
+ * touching OpenGL.
+ */
+void canvashdl::begin(scenehdl *scene)
+{
+	scene->update();
+
+	view = identity<float, 4, 4>();
+	projection = identity<float, 4, 4>();
+	if (scene->active_camera_valid())
+	{
+		camerahdl *camera = scene->cameras[scene->active_camera];
+		camera->update_view();
+		camera->update_projection();
+		view = camera->view_matrix;
+		projection = camera->projection_matrix;
+	}
+
+	memset(&lights, 0, sizeof(lights));
+	for (unsigned int i = 0; i < scene->lights.size(); i++)
+		if (scene->lights[i] != NULL)
+		{
+			scene->lights[i]->update(view);
+			scene->lights[i]->apply(lights);
+		}
+}
+
+/* load_texture
+ *
+ * Load res/texture.png for the texture material if it isn't
+ * already. A missing texture is drawn white.
+ */
+void canvashdl::load_texture()
+{
+	if (texture.size() > 0)
+		return;
+
+	unsigned char *image = NULL;
+	unsigned int error = lodepng_decode32_file(&image, &texture_width, &texture_height, (working_directory + "res/texture.png").c_str());
+	if (error)
+	{
+		cerr << "Error: Unable to load " << working_directory << "res/texture.png: " << lodepng_error_text(error) << endl;
+		texture.assign(4, 255);
+		texture_width = 1;
+		texture_height = 1;
+	}
+	else
+		texture.assign(image, image + texture_width*texture_height*4);
+	free(image);
+}
+
+/* draw
+ *
+ * Render the scene on top of what is already in the canvas. This
+ * culls and picks the levels of detail the same way scenehdl::draw
+ * does, but leaves out the normals and the bounding boxes.
+ */
+void canvashdl::draw(scenehdl *scene)
+{
+	begin(scene);
+	vector<int> shown = scene->visible(projection*view);
+
+	draws.clear();
+	int vertex_count = 0;
+	int input_count = 0;
+	bool textured = false;
+	for (unsigned int k = 0; k < shown.size(); k++)
+	{
+		objecthdl *object = scene->objects[shown[k]];
+		mat4f modelview = view*object->world_matrix();
+		float pixels = object->pixels_per_unit(modelview, projection, height);
+		for (unsigned int j = 0; j < object->rigid.size(); j++)
+		{
+			rigidhdl &rigid = object->rigid[j];
+			rigid.select_lod(pixels, object->lod_tolerance);
+
+			map<string, materialhdl*>::iterator material = object->material.find(rigid.material);
+
+			canvasdrawhdl d;
+			d.set_material(material != object->material.end() ? material->second : NULL);
+			d.mesh = rigid.mesh.get();
+			d.indices = (rigid.lod == 0 ? &d.mesh->indices : &d.mesh->lods[rigid.lod-1]);
+			if (d.shading == shade_none || d.indices->size() < 3)
+				continue;
+
+			d.modelview = modelview;
+			d.first_vertex = vertex_count;
+			d.first_triangle = input_count;
+			vertex_count += (int)d.mesh->geometry.size();
+			input_count += (int)d.indices->size()/3;
+			textured = textured || d.shading == shade_texture;
+			draws.push_back(d);
+		}
+	}
+
+	if (textured)
+		load_texture();
+
+	poolhdl &pool = poolhdl::shared();
+
+	vertices.resize(vertex_count);
+	pool.run((vertex_count + batch_size - 1)/batch_size, [this, vertex_count](int i) {
+		shade_vertices(i*batch_size, min((i+1)*batch_size, vertex_count));
+	});
+
+	int batches = (input_count + batch_size - 1)/batch_size;
+	triangles.resize(batches);
+	bins.resize(batches);
+	pool.run(batches, [this](int i) {
+		setup_triangles(i);
+	});
+
+	triangle_count = 0;
+	for (int i = 0; i < batches; i++)
+		triangle_count += (int)triangles[i].size();
+
+	pool.run(tiles_wide*tiles_high, [this](int i) {
+		rasterize(i);
+	});
+}
+
+/* save
+ *
+ * Write the image to a png at 'filename'.
+ */
+bool canvashdl::save(string filename)
+{
+	vector<unsigned char> image(width*height*4);
+	for (int y = 0; y < height; y++)
+		memcpy(&image[y*width*4], &color[y*stride*4], width*4);
+
+	unsigned int error = lodepng_encode32_file(filename.c_str(), image.data(), width, height);
+	if (error)
+	{
+		cerr << "Error: Unable to write " << filename << ": " << lodepng_error_text(error) << endl;
+		return false;
+	}
+	return true;
+}
+
+/* find_draw
+ *
+ * Find the draw whose vertices (or triangles) include 'index',
+ * given the first vertex (or triangle) of each draw.
+ */
+static int find_draw(const vector<canvasdrawhdl> &draws, int index, bool vertex)
+{
+	int lo = 0, hi = (int)draws.size() - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1)/2;
+		if ((vertex ? draws[mid].first_vertex : draws[mid].first_triangle) <= index)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* shade_vertices
+ *
+ * Run the vertex stage on the vertices from 'start' to 'end' of
+ * the frame.
+ */
+void canvashdl::shade_vertices(int start, int end)
+{
+	int d = find_draw(draws, start, true);
+	for (int i = start; i < end; d++)
+	{
+		const canvasdrawhdl &draw = draws[d];
+		const vector<vec8f> &geometry = draw.mesh->geometry;
+		int stop = min(end, draw.first_vertex + (int)geometry.size());
+
+		for (; i < stop; i++)
+			shade_vertex(draw, geometry[i - draw.first_vertex], vertices[i]);
+	}
+}
+
+/* shade_vertex
+ *
+ * Run the vertex stage on one vertex of a draw. This is what the
+ * vertex shaders in res/ do.
+ */
+void canvashdl::shade_vertex(const canvasdrawhdl &draw, const vec8f &g, canvasvertexhdl &v) const
+{
+	const mat4f &m = draw.modelview;
+	const mat4f &p = projection;
+
+	vec3f vertex, normal;
+	for (int r = 0; r < 3; r++)
+	{
+		vertex[r] = m[r][0]*g[0] + m[r][1]*g[1] + m[r][2]*g[2] + m[r][3];
+		normal[r] = m[r][0]*g[3] + m[r][1]*g[4] + m[r][2]*g[5];
+	}
+
+	for (int r = 0; r < 4; r++)
+		v.clip[r] = p[r][0]*vertex[0] + p[r][1]*vertex[1] + p[r][2]*vertex[2] + p[r][3];
+
+	if (draw.shading == shade_gouraud)
+	{
+		vec3f c = lights.shade(draw.emission, draw.ambient, draw.diffuse, draw.specular, draw.shininess, vertex, norm(normal));
+		for (int r = 0; r < 3; r++)
+			v.varying[r] = c[r];
+	}
+	else if (draw.shading != shade_solid)
+	{
+		for (int r = 0; r < 3; r++)
+		{
+			v.varying[r] = vertex[r];
+			v.varying[3+r] = normal[r];
+		}
+
+		// Texture coordinates, or the object space position
+		// that res/custom.vx lays the bricks out in.
+		v.varying[6] = (draw.shading == shade_custom ? g[0] : g[6]);
+		v.varying[7] = (draw.shading == shade_custom ? g[1] : g[7]);
+	}
+}
+
+/* setup_triangles
+ *
+ * Assemble, clip and set up the triangles of one batch, then sort
+ * them into the tiles that their bounds touch.
+ */
+void canvashdl::setup_triangles(int batch)
+{
+	vector<canvastrianglehdl> &result = triangles[batch];
+	vector<vector<int> > &bin = bins[batch];
+	result.clear();
+	bin.resize(tiles_wide*tiles_high);
+	for (unsigned int i = 0; i < bin.size(); i++)
+		bin[i].clear();
+
+	const canvasdrawhdl &last = draws.back();
+	int start = batch*batch_size;
+	int end = min(start + batch_size, last.first_triangle + (int)last.indices->size()/3);
+
+	int d = find_draw(draws, start, false);
+	for (int i = start; i < end; i++)
+	{
+		while (i >= draws[d].first_triangle + (int)draws[d].indices->size()/3)
+			d++;
+
+		const int *index = &(*draws[d].indices)[(i - draws[d].first_triangle)*3];
+		const canvasvertexhdl *v = &vertices[draws[d].first_vertex];
+
+		int first = (int)result.size();
+		setup(d, v + index[0], v + index[1], v + index[2], result);
+
+		for (int j = first; j < (int)result.size(); j++)
+		{
+			const int *bound = result[j].bound;
+			for (int y = bound[1]/tile_size; y <= bound[3]/tile_size; y++)
+				for (int x = bound[0]/tile_size; x <= bound[2]/tile_size; x++)
+					bin[y*tiles_wide + x].push_back(j);
+		}
+	}
+}
+
+/* setup
+ *
+ * Clip a triangle in clip space and emit what's left of it. Triangles
+ * entirely outside of one of the planes of the view frustum are thrown
+ * away. Otherwise they are only clipped against the near and far planes
+ * and the edges of the guard band, and rasterization takes care of
+ * the edges of the screen.
+ */
+void canvashdl::setup(int draw, const canvasvertexhdl *v0, const canvasvertexhdl *v1, const canvasvertexhdl *v2, vector<canvastrianglehdl> &result)
+{
+	float gx = 1.0f + 2.0f*guard_band/(float)width;
+	float gy = 1.0f + 2.0f*guard_band/(float)height;
+
+	// (x, y, z, w) of the planes, points on the inside have a
+	// positive dot product with them.
+	const float planes[6][4] = {
+		{ 1.0f,  0.0f,  0.0f, gx},
+		{-1.0f,  0.0f,  0.0f, gx},
+		{ 0.0f,  1.0f,  0.0f, gy},
+		{ 0.0f, -1.0f,  0.0f, gy},
+		{ 0.0f,  0.0f,  1.0f, 1.0f},
+		{ 0.0f,  0.0f, -1.0f, 1.0f}
+	};
+
+	const canvasvertexhdl *v[3] = {v0, v1, v2};
+	int outside = 0x3F, clip = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const float *c = v[i]->clip;
+		int frustum = (c[0] < -c[3] ? 0x01 : 0) | (c[0] > c[3] ? 0x02 : 0) | (c[1] < -c[3] ? 0x04 : 0) | (c[1] > c[3] ? 0x08 : 0) | (c[2] < -c[3] ? 0x10 : 0) | (c[2] > c[3] ? 0x20 : 0);
+		int guard = (c[0] < -gx*c[3] ? 0x01 : 0) | (c[0] > gx*c[3] ? 0x02 : 0) | (c[1] < -gy*c[3] ? 0x04 : 0) | (c[1] > gy*c[3] ? 0x08 : 0) | (frustum & 0x30);
+		outside &= frustum;
+		clip |= guard;
+	}
+
+	if (outside != 0)
+		return;
+
+	if (clip == 0)
+	{
+		emit(draw, v0, v1, v2, result);
+		return;
+	}
+
+	// Sutherland-Hodgman against just the planes that were crossed.
+	canvasvertexhdl polygon[2][9];
+	int count = 3;
+	polygon[0][0] = *v0;
+	polygon[0][1] = *v1;
+	polygon[0][2] = *v2;
+
+	int current = 0;
+	for (int p = 0; p < 6 && count > 0; p++)
+	{
+		if ((clip & (1 << p)) == 0)
+			continue;
+
+		const canvasvertexhdl *in = polygon[current];
+		canvasvertexhdl *out = polygon[1-current];
+		int next = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const canvasvertexhdl &a = in[i];
+			const canvasvertexhdl &b = in[(i+1)%count];
+			float da = planes[p][0]*a.clip[0] + planes[p][1]*a.clip[1] + planes[p][2]*a.clip[2] + planes[p][3]*a.clip[3];
+			float db = planes[p][0]*b.clip[0] + planes[p][1]*b.clip[1] + planes[p][2]*b.clip[2] + planes[p][3]*b.clip[3];
+
+			if (da >= 0.0f)
+				out[next++] = a;
+
+			if ((da >= 0.0f) != (db >= 0.0f))
+			{
+				float t = da/(da - db);
+				canvasvertexhdl &c = out[next++];
+				for (int j = 0; j < 4; j++)
+					c.clip[j] = a.clip[j] + (b.clip[j] - a.clip[j])*t;
+				for (int j = 0; j < 8; j++)
+					c.varying[j] = a.varying[j] + (b.varying[j] - a.varying[j])*t;
+			}
+		}
+
+		count = next;
+		current = 1-current;
+	}
+
+	for (int i = 2; i < count; i++)
+		emit(draw, &polygon[current][0], &polygon[current][i-1], &polygon[current][i], result);
+}
+
+/* emit
+ *
+ * Set up a triangle that is entirely inside of the guard band and
+ * between the near and far planes. Triangles with no area, or that
+ * don't cover the center of any pixel, are dropped.
+ */
+void canvashdl::emit(int draw, const canvasvertexhdl *v0, const canvasvertexhdl *v1, const canvasvertexhdl *v2, vector<canvastrianglehdl> &result)
+{
+	canvastrianglehdl t;
+	t.draw = draw;
+
+	const canvasvertexhdl *v[3] = {v0, v1, v2};
+	for (int i = 0; i < 3; i++)
+	{
+		float inv_w = 1.0f/v[i]->clip[3];
+		float x = (v[i]->clip[0]*inv_w*0.5f + 0.5f)*(float)width;
+		float y = (0.5f - v[i]->clip[1]*inv_w*0.5f)*(float)height;
+		t.x[i] = (int)floorf(x*16.0f + 0.5f);
+		t.y[i] = (int)floorf(y*16.0f + 0.5f);
+		t.depth[i] = v[i]->clip[2]*inv_w*0.5f + 0.5f;
+		t.inv_w[i] = inv_w;
+		for (int j = 0; j < 8; j++)
+			t.varying[i][j] = v[i]->varying[j]*inv_w;
+	}
+
+	t.area = (long long)(t.x[2] - t.x[1])*(long long)(t.y[0] - t.y[1]) - (long long)(t.y[2] - t.y[1])*(long long)(t.x[0] - t.x[1]);
+	if (t.area == 0)
+		return;
+
+	// Nothing is culled, so put every triangle in the same winding
+	// to keep the inside of the edges positive.
+	if (t.area < 0)
+	{
+		swap(t.x[1], t.x[2]);
+		swap(t.y[1], t.y[2]);
+		swap(t.depth[1], t.depth[2]);
+		swap(t.inv_w[1], t.inv_w[2]);
+		for (int j = 0; j < 8; j++)
+			swap(t.varying[1][j], t.varying[2][j]);
+		t.area = -t.area;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		int j = (i+1)%3, k = (i+2)%3;
+		t.a[i] = t.y[j] - t.y[k];
+		t.b[i] = t.x[k] - t.x[j];
+		t.c[i] = -((long long)t.a[i]*(long long)t.x[j] + (long long)t.b[i]*(long long)t.y[j]);
+	}
+
+	// Pixel centers are at 8 in fixed point.
+	int left = min(t.x[0], min(t.x[1], t.x[2]));
+	int right = max(t.x[0], max(t.x[1], t.x[2]));
+	int top = min(t.y[0], min(t.y[1], t.y[2]));
+	int bottom = max(t.y[0], max(t.y[1], t.y[2]));
+	t.bound[0] = max(0, (left - 8 + 15) >> 4);
+	t.bound[1] = max(0, (top - 8 + 15) >> 4);
+	t.bound[2] = min(width-1, (right - 8) >> 4);
+	t.bound[3] = min(height-1, (bottom - 8) >> 4);
+	if (t.bound[0] > t.bound[2] || t.bound[1] > t.bound[3])
+		return;
+
+	double area = (double)t.area;
+	t.depth_dx = (float)(((double)(t.depth[1] - t.depth[0])*t.a[1] + (double)(t.depth[2] - t.depth[0])*t.a[2])*16.0/area);
+	t.depth_dy = (float)(((double)(t.depth[1] - t.depth[0])*t.b[1] + (double)(t.depth[2] - t.depth[0])*t.b[2])*16.0/area);
+	t.near = min(t.depth[0], min(t.depth[1], t.depth[2]));
+
+	result.push_back(t);
+}
+
+/* rasterize
+ *
+ * Draw every triangle binned into 'tile', in the order that they
+ * were submitted.
+ */
+void canvashdl::rasterize(int tile)
+{
+	int left = (tile%tiles_wide)*tile_size;
+	int top = (tile/tiles_wide)*tile_size;
+	int right = min(left + tile_size, width) - 1;
+	int bottom = min(top + tile_size, height) - 1;
+
+	for (unsigned int i = 0; i < bins.size() && i < triangles.size(); i++)
+	{
+		const vector<int> &bin = bins[i][tile];
+		for (unsigned int j = 0; j < bin.size(); j++)
+		{
+			const canvastrianglehdl &t = triangles[i][bin[j]];
+			rasterize(t, max(left, t.bound[0]), max(top, t.bound[1]), min(right, t.bound[2]), min(bottom, t.bound[3]));
+		}
+	}
+}
+
+/* rasterize
+ *
+ * Draw the part of a triangle that falls in the given pixels, which
+ * must all be in one tile. Edges follow the top-left rule, so pixels
+ * on an edge shared by two triangles are only drawn once.
+ */
+void canvashdl::rasterize(const canvastrianglehdl &t, int left, int top, int right, int bottom)
+{
+	// Pixels on an edge that isn't a top or left edge are outside.
+	int bias[3];
+	for (int i = 0; i < 3; i++)
+		bias[i] = (t.a[i] > 0 || (t.a[i] == 0 && t.b[i] > 0)) ? 0 : -1;
+
+	int blocks_wide = stride/block_size;
+	for (int by = top/block_size; by <= bottom/block_size; by++)
+		for (int bx = left/block_size; bx <= right/block_size; bx++)
+		{
+			float &farthest = hiz[by*blocks_wide + bx];
+			if (t.near >= farthest)
+				continue;
+
+			int x0 = bx*block_size, y0 = by*block_size;
+			long long X = x0*16 + 8, Y = y0*16 + 8;
+
+			// The edge functions at the first pixel of the block, and
+			// how they change from one pixel to the next. An edge that
+			// the whole block is inside of is left out, which also keeps
+			// the rest small enough for 32 bits.
+			int e[3], dx[3], dy[3];
+			bool inside = true;
+			for (int i = 0; i < 3 && inside; i++)
+			{
+				long long value = t.a[i]*X + t.b[i]*Y + t.c[i] + bias[i];
+				long long span_x = (long long)t.a[i]*16*(block_size-1);
+				long long span_y = (long long)t.b[i]*16*(block_size-1);
+				long long highest = value + max(span_x, 0LL) + max(span_y, 0LL);
+				long long lowest = value + min(span_x, 0LL) + min(span_y, 0LL);
+
+				if (highest < 0)
+					inside = false;
+				else if (lowest >= 0)
+				{
+					e[i] = 0;
+					dx[i] = 0;
+					dy[i] = 0;
+				}
+				else
+				{
+					e[i] = (int)value;
+					dx[i] = t.a[i]*16;
+					dy[i] = t.b[i]*16;
+				}
+			}
+
+			if (!inside)
+				continue;
+
+			// Depth at the first pixel of the block.
+			float z0 = t.depth[0] + (float)(((double)(t.depth[1] - t.depth[0])*(double)(t.a[1]*X + t.b[1]*Y + t.c[1]) + (double)(t.depth[2] - t.depth[0])*(double)(t.a[2]*X + t.b[2]*Y + t.c[2]))/(double)t.area);
+
+#ifdef __SSE2__
+			const __m128i steps = _mm_setr_epi32(0, 1, 2, 3);
+			__m128i ramp[3];
+			for (int i = 0; i < 3; i++)
+				ramp[i] = _mm_setr_epi32(0, dx[i], 2*dx[i], 3*dx[i]);
+#endif
+
+			bool written = false;
+			for (int y = 0; y < block_size; y++)
+			{
+				float *zbuffer = &depth[(y0 + y)*stride + x0];
+				unsigned char *pixels = &color[((y0 + y)*stride + x0)*4];
+				float zrow = z0 + t.depth_dy*(float)y;
+
+#ifdef __SSE2__
+				for (int x = 0; x < block_size; x += 4)
+				{
+					__m128i covered = _mm_setzero_si128();
+					for (int i = 0; i < 3; i++)
+						covered = _mm_or_si128(covered, _mm_add_epi32(ramp[i], _mm_set1_epi32(e[i] + dx[i]*x + dy[i]*y)));
+
+					// The sign bit is set if any of the edges are negative.
+					int mask = (~_mm_movemask_ps(_mm_castsi128_ps(covered))) & 0xF;
+					if (mask == 0)
+						continue;
+
+					__m128 z = _mm_add_ps(_mm_set1_ps(zrow + t.depth_dx*(float)x), _mm_mul_ps(_mm_set1_ps(t.depth_dx), _mm_cvtepi32_ps(steps)));
+					__m128 old = _mm_loadu_ps(zbuffer + x);
+					mask &= _mm_movemask_ps(_mm_cmplt_ps(z, old));
+					if (mask == 0)
+						continue;
+
+					__m128 write = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(mask), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128()));
+					_mm_storeu_ps(zbuffer + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, old)));
+					written = true;
+
+					for (int i = 0; i < 4; i++)
+						if (mask & (1 << i))
+							shade(t, x0 + x + i, y0 + y, pixels + (x + i)*4);
+				}
+#else
+				for (int x = 0; x < block_size; x++)
+				{
+					if ((e[0] + dx[0]*x + dy[0]*y) < 0 || (e[1] + dx[1]*x + dy[1]*y) < 0 || (e[2] + dx[2]*x + dy[2]*y) < 0)
+						continue;
+
+					float z = zrow + t.depth_dx*(float)x;
+					if (z >= zbuffer[x])
+						continue;
+
+					zbuffer[x] = z;
+					written = true;
+					shade(t, x0 + x, y0 + y, pixels + x*4);
+				}
+#endif
+			}
+
+			if (written)
+			{
+				float result = 0.0f;
+				for (int y = 0; y < block_size; y++)
+				{
+					const float *zbuffer = &depth[(y0 + y)*stride + x0];
+					for (int x = 0; x < block_size; x++)
+						result = max(result, zbuffer[x]);
+				}
+				farthest = result;
+			}
+		}
+}
+
+/* sample
+ *
+ * Look up the texture at (u, v) with bilinear filtering and
+ * wrapping, like res/texture.ft.
+ */
+static vec3f sample(const vector<unsigned char> &texture, int width, int height, float u, float v)
+{
+	float x = u*(float)width - 0.5f;
+	float y = v*(float)height - 0.5f;
+	float fx = floorf(x), fy = floorf(y);
+	float tx = x - fx, ty = y - fy;
+	int x0 = (int)fx % width, y0 = (int)fy % height;
+	if (x0 < 0)
+		x0 += width;
+	if (y0 < 0)
+		y0 += height;
+	int x1 = (x0 + 1)%width, y1 = (y0 + 1)%height;
+
+	vec3f result;
+	for (int i = 0; i < 3; i++)
+	{
+		float top = (float)texture[(y0*width + x0)*4 + i]*(1.0f - tx) + (float)texture[(y0*width + x1)*4 + i]*tx;
+		float bottom = (float)texture[(y1*width + x0)*4 + i]*(1.0f - tx) + (float)texture[(y1*width + x1)*4 + i]*tx;
+		result[i] = (top*(1.0f - ty) + bottom*ty)/255.0f;
+	}
+	return result;
+}
+
+/* shade
+ *
+ * Interpolate the varyings of a triangle at the pixel (x, y), shade
+ * it and write the color to 'pixel'.
+ */
+void canvashdl::shade(const canvastrianglehdl &t, int x, int y, unsigned char *pixel)
+{
+	const canvasdrawhdl &draw = draws[t.draw];
+
+	// Perspective correct barycentric coordinates
+	long long X = x*16 + 8, Y = y*16 + 8;
+	float l1 = (float)((double)(t.a[1]*X + t.b[1]*Y + t.c[1])/(double)t.area);
+	float l2 = (float)((double)(t.a[2]*X + t.b[2]*Y + t.c[2])/(double)t.area);
+	float l0 = 1.0f - l1 - l2;
+	float w = 1.0f/(l0*t.inv_w[0] + l1*t.inv_w[1] + l2*t.inv_w[2]);
+	l0 *= w;
+	l1 *= w;
+	l2 *= w;
+
+	int count = (draw.shading == shade_solid ? 0 : (draw.shading == shade_gouraud ? 3 : 8));
+	float varying[8];
+	for (int i = 0; i < count; i++)
+		varying[i] = t.varying[0][i]*l0 + t.varying[1][i]*l1 + t.varying[2][i]*l2;
+
+	store(pixel, shade_fragment(draw, varying));
+}
+
+/* shade_fragment
+ *
+ * Run the fragment stage given the interpolated varyings of a draw.
+ * This is what the fragment shaders in res/ do.
+ */
+vec3f canvashdl::shade_fragment(const canvasdrawhdl &draw, const float *varying) const
+{
+	if (draw.shading == shade_solid)
+		return draw.emission;
+	else if (draw.shading == shade_gouraud)
+		return vec3f(varying[0], varying[1], varying[2]);
+
+	vec3f vertex(varying[0], varying[1], varying[2]);
+	vec3f normal = norm(vec3f(varying[3], varying[4], varying[5]));
+
+	if (draw.shading == shade_phong)
+		return lights.shade(draw.emission, draw.ambient, draw.diffuse, draw.specular, draw.shininess, vertex, normal);
+	else if (draw.shading == shade_custom)
+	{
+		// The bricks of res/custom.ft
+		float bx = varying[6]/0.25f, by = varying[7]/0.25f;
+		if (by*0.5f - floorf(by*0.5f) > 0.5f)
+			bx += 0.5f;
+
+		float brick = ((bx - floorf(bx) <= 0.9f) && (by - floorf(by) <= 0.9f)) ? 1.0f : 0.0f;
+		vec3f diffuse = vec3f(0.4f, 0.4f, 0.4f)*(1.0f - brick) + vec3f(0.8f, 0.0f, 0.0f)*brick;
+		return lights.shade(vec3f(0.0f, 0.0f, 0.0f), diffuse, diffuse, diffuse, 1.0f, vertex, normal);
+	}
+
+	vec3f c = sample(texture, texture_width, texture_height, varying[6], varying[7]);
+	return lights.shade(vec3f(0.0f, 0.0f, 0.0f), c, c, c, c[0], vertex, normal);
+}
+
+/* store
+ *
+ * Write a color to a pixel of the image.
+ */
+void canvashdl::store(unsigned char *pixel, const vec3f &color)
+{
+	for (int i = 0; i < 3; i++)
+		pixel[i] = (unsigned char)(core::clamp(color[i], 0.0f, 1.0f)*255.0f + 0.5f);
+	pixel[3] = 255;
+}
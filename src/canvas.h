@@ -0,0 +1,175 @@
+/*
+ * canvas.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include "light.h"
+
+using namespace core;
+
+#ifndef canvas_h
+#define canvas_h
+
+struct scenehdl;
+struct meshhdl;
+struct materialhdl;
+
+/* A vertex after the vertex stage of canvashdl. 'clip' is its clip
+ * space position and 'varying' holds whatever the material needs
+ * interpolated across the triangle: the lit color for gouraud, the
+ * eye space position and normal for phong, followed by the texture
+ * or brick coordinates for texture and custom.
+ */
+struct canvasvertexhdl
+{
+	float clip[4];
+	float varying[8];
+};
+
+/* A triangle that is ready to be rasterized. The vertices are in
+ * screen space, with y pointing down, in fixed point with four bits
+ * below the pixel. Edge i is the one across from vertex i, and
+ * a*x + b*y + c is positive on the inside of it. Depth is linear
+ * in screen space, the varyings are divided by w.
+ */
+struct canvastrianglehdl
+{
+	int draw;
+	int x[3], y[3];
+	int a[3], b[3];
+	long long c[3];
+	long long area;
+	float depth[3];
+	float depth_dx, depth_dy;
+	float inv_w[3];
+	float varying[3][8];
+
+	// The pixels that the triangle might cover, (left, top, right,
+	// bottom) inclusive, and the nearest depth it has.
+	int bound[4];
+	float near;
+};
+
+/* One rigid body to be drawn by canvashdl, with everything that its
+ * material's shaders would have gotten in uniforms.
+ */
+struct canvasdrawhdl
+{
+	meshhdl *mesh;
+	const vector<int> *indices;
+	mat4f modelview;
+	int shading;
+
+	vec3f emission;
+	vec3f ambient;
+	vec3f diffuse;
+	vec3f specular;
+	float shininess;
+
+	// Where this draw's vertices and triangles start in the frame.
+	int first_vertex;
+	int first_triangle;
+
+	int set_material(const materialhdl *material);
+};
+
+/* A software rasterizer that renders a scene into memory without
+ * OpenGL, for machines that don't have a GPU or a driver for it.
+ * Each material is shaded the same way as its shaders in res/.
+ *
+ * The screen is split into 64 by 64 pixel tiles. The vertices and
+ * triangles are set up in parallel, in batches that each sort their
+ * triangles into the tiles they touch, then every tile is rasterized
+ * by its own job on the thread pool. A tile only ever goes through
+ * its bins in the order the triangles were submitted, so the image
+ * doesn't depend on how the jobs were scheduled.
+ *
+ * Rasterization walks the tiles in 8 by 8 pixel blocks. Blocks
+ * outside of an edge or behind the farthest depth already in the
+ * block, which is kept in 'hiz', are skipped. The rest evaluate the
+ * edge functions and the depth test four pixels at a time with SSE2.
+ */
+struct canvashdl
+{
+	canvashdl();
+	~canvashdl();
+
+	enum
+	{
+		tile_size = 64,
+		block_size = 8,
+		batch_size = 4096,
+		// The largest width and height that the fixed point
+		// coordinates are sized for.
+		max_size = 4096
+	};
+
+	enum
+	{
+		shade_none = 0,
+		shade_solid = 1,
+		shade_gouraud = 2,
+		shade_phong = 3,
+		shade_custom = 4,
+		shade_texture = 5
+	};
+
+	int width, height;
+	int tiles_wide, tiles_high;
+
+	// Four bytes per pixel, rgba, with the top row first.
+	vector<unsigned char> color;
+
+	// The depth of every pixel mapped onto [0, 1] like OpenGL, and
+	// the farthest one in each 8 by 8 block.
+	vector<float> depth;
+	vector<float> hiz;
+
+	// Rows are padded out to a whole number of blocks.
+	int stride, rows;
+
+	// Everything that is drawn in the frame. Batch i sets up the
+	// input triangles starting at i*batch_size into triangles[i],
+	// and bins[i][j] lists the ones that touch tile j.
+	vector<canvasdrawhdl> draws;
+	vector<canvasvertexhdl> vertices;
+	vector<vector<canvastrianglehdl> > triangles;
+	vector<vector<vector<int> > > bins;
+	mat4f view;
+	mat4f projection;
+	lightblockhdl lights;
+
+	// res/texture.png for the texture material, loaded when it is
+	// first needed.
+	vector<unsigned char> texture;
+	unsigned int texture_width, texture_height;
+
+	// How many triangles the last draw() rasterized.
+	int triangle_count;
+
+	void resize(int width, int height);
+	void clear(vec3f background);
+	void begin(scenehdl *scene);
+	void load_texture();
+	void draw(scenehdl *scene);
+	bool save(string filename);
+
+	void shade_vertex(const canvasdrawhdl &draw, const vec8f &g, canvasvertexhdl &v) const;
+	vec3f shade_fragment(const canvasdrawhdl &draw, const float *varying) const;
+	static void store(unsigned char *pixel, const vec3f &color);
+
+private:
+	void shade_vertices(int start, int end);
+	void setup_triangles(int batch);
+	void setup(int draw, const canvasvertexhdl *v0, const canvasvertexhdl *v1, const canvasvertexhdl *v2, vector<canvastrianglehdl> &result);
+	void emit(int draw, const canvasvertexhdl *v0, const canvasvertexhdl *v1, const canvasvertexhdl *v2, vector<canvastrianglehdl> &result);
+	void rasterize(int tile);
+	void rasterize(const canvastrianglehdl &t, int left, int top, int right, int bottom);
+	void shade(const canvastrianglehdl &t, int x, int y, unsigned char *pixel);
+};
+
+#endif
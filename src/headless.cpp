@@ -0,0 +1,435 @@
+/*
+ * headless.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "headless.h"
+#include "canvas.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "camera.h"
+#include "model.h"
+#include "primitive.h"
+#include "light.h"
+#include "lodepng.h"
+#include <iomanip>
+
+#ifdef LINUX
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+extern string working_directory;
+
+headlesshdl::headlesshdl()
+{
+	display = NULL;
+	context = NULL;
+	surface = NULL;
+	width = 0;
+	height = 0;
+	framebuffer = 0;
+	renderbuffer[0] = 0;
+	renderbuffer[1] = 0;
+}
+
+headlesshdl::~headlesshdl()
+{
+	close();
+}
+
+#ifdef LINUX
+/* has_extension
+ *
+ * Check for 'name' in a space separated list of EGL extensions.
+ */
+static bool has_extension(const char *extensions, string name)
+{
+	if (extensions == NULL)
+		return false;
+
+	istringstream list(extensions);
+	string extension;
+	while (list >> extension)
+		if (extension == name)
+			return true;
+	return false;
+}
+#endif
+
+/* open
+ *
+ * Create the context and make it current, then create a 'width' by
+ * 'height' framebuffer with color and depth and bind it so that
+ * everything drawn afterwards ends up there.
+ */
+bool headlesshdl::open(int width, int height)
+{
+#ifdef LINUX
+	// Without a display server, the surfaceless platform is the only
+	// one that Mesa can open. Fall back on the default display for
+	// drivers that don't have it.
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+	if (has_extension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (get_platform_display != NULL)
+			egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+
+	if (egl_display == EGL_NO_DISPLAY)
+		egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, NULL, NULL))
+	{
+		cerr << "Error: Unable to open an EGL display." << endl;
+		return false;
+	}
+	display = egl_display;
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		cerr << "Error: This EGL implementation doesn't support desktop OpenGL." << endl;
+		close();
+		return false;
+	}
+
+	const char *extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+
+	EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = NULL;
+	EGLint count = 0;
+	if (!eglChooseConfig(egl_display, config_attributes, &config, 1, &count) || count == 0)
+		config = NULL;
+
+	if (config == NULL && !has_extension(extensions, "EGL_KHR_no_config_context"))
+	{
+		cerr << "Error: Unable to find an EGL config for OpenGL." << endl;
+		close();
+		return false;
+	}
+
+	context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, NULL);
+	if (context == EGL_NO_CONTEXT)
+	{
+		cerr << "Error: Unable to create an OpenGL context." << endl;
+		context = NULL;
+		close();
+		return false;
+	}
+
+	// Everything is drawn into the framebuffer object, so the
+	// context only needs a surface if it can't go without one.
+	if (!has_extension(extensions, "EGL_KHR_surfaceless_context") && config != NULL)
+	{
+		EGLint surface_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		surface = eglCreatePbufferSurface(egl_display, config, surface_attributes);
+		if (surface == EGL_NO_SURFACE)
+			surface = NULL;
+	}
+
+	if (!eglMakeCurrent(egl_display, (EGLSurface)surface, (EGLSurface)surface, (EGLContext)context))
+	{
+		cerr << "Error: Unable to make the OpenGL context current." << endl;
+		close();
+		return false;
+	}
+#else
+	cerr << "Error: Headless rendering goes through EGL, which is only set up on Linux." << endl;
+	return false;
+#endif
+
+#ifdef __GLEW_H__
+	// GLEW also looks for a GLX display, which there isn't one of
+	// here. The OpenGL entry points are loaded before it gives up.
+	GLenum err = glewInit();
+	if (GLEW_OK != err
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		&& GLEW_ERROR_NO_GLX_DISPLAY != err
+#endif
+		)
+	{
+		cerr << "Error: " << glewGetErrorString(err) << endl;
+		close();
+		return false;
+	}
+#endif
+
+	cout << "Status: Using OpenGL " << glGetString(GL_VERSION) << endl;
+	cout << "Status: Using GLSL " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
+
+	if (!uniform_buffers_supported())
+	{
+		cerr << "Error: The lighting shaders need OpenGL 3.1 or GL_ARB_uniform_buffer_object." << endl;
+		close();
+		return false;
+	}
+
+	this->width = width;
+	this->height = height;
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glGenRenderbuffers(2, renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer[0]);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer[1]);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cerr << "Error: Unable to create a " << width << "x" << height << " framebuffer." << endl;
+		close();
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+/* close
+ *
+ * Delete the framebuffer and destroy the context. Anything else
+ * that holds OpenGL objects should be deleted before this.
+ */
+void headlesshdl::close()
+{
+	if (framebuffer != 0)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(2, renderbuffer);
+	}
+	framebuffer = 0;
+	renderbuffer[0] = 0;
+	renderbuffer[1] = 0;
+
+#ifdef LINUX
+	if (display != NULL)
+	{
+		eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (surface != NULL)
+			eglDestroySurface((EGLDisplay)display, (EGLSurface)surface);
+		if (context != NULL)
+			eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+		eglTerminate((EGLDisplay)display);
+	}
+#endif
+	display = NULL;
+	context = NULL;
+	surface = NULL;
+}
+
+/* save
+ *
+ * Read back the framebuffer and write it to a png at 'filename'.
+ * OpenGL puts the bottom row first and png the top one, so the
+ * rows are flipped on the way.
+ */
+bool headlesshdl::save(string filename)
+{
+	vector<unsigned char> pixels(width*height*4), image(width*height*4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	for (int y = 0; y < height; y++)
+		memcpy(&image[y*width*4], &pixels[(height-1-y)*width*4], width*4);
+
+	unsigned int error = lodepng_encode32_file(filename.c_str(), image.data(), width, height);
+	if (error)
+	{
+		cerr << "Error: Unable to write " << filename << ": " << lodepng_error_text(error) << endl;
+		return false;
+	}
+	return true;
+}
+
+/* headless_usage
+ *
+ * Print the command line options of headless_main().
+ */
+static void headless_usage(string program)
+{
+	cerr << "Usage: " << program << " --headless [options] [file.obj|box|cylinder|sphere|pyramid]..." << endl;
+	cerr << "  -s WIDTHxHEIGHT  size of the frames, 750x750 by default" << endl;
+	cerr << "  -n FRAMES        number of frames to render, 1 by default" << endl;
+	cerr << "  -o PREFIX        write PREFIX0000.png, PREFIX0001.png, ... 'frame' by default" << endl;
+	cerr << "  -p X Y Z         position of the camera, 0 0 10 by default" << endl;
+	cerr << "  -r X Y Z         orientation of the camera in radians, 0 0 0 by default" << endl;
+	cerr << "  -c               render on the CPU with the software rasterizer instead of OpenGL" << endl;
+	cerr << "  -t               render on the CPU with the ray tracer instead of OpenGL" << endl;
+}
+
+/* headless_main
+ *
+ * Render a scene into png files without opening a window. This runs
+ * in place of the GLUT main loop when the program is started with
+ * --headless. The scene is made of the models and primitives named
+ * on the command line, all at the origin, lit by one directional
+ * light and seen through a frustum camera. The frame time, without
+ * the time it takes to write the pngs, is printed at the end. With -c
+ * the frames are drawn by canvashdl, and with -t by raytracerhdl, and
+ * OpenGL isn't used at all.
+ */
+int headless_main(int argc, char **argv)
+{
+	int width = 750, height = 750, frames = 1;
+	string output = "frame";
+	vec3f position(0.0f, 0.0f, 10.0f);
+	vec3f orientation(0.0f, 0.0f, 0.0f);
+	vector<string> sources;
+	bool software = false;
+	bool traced = false;
+
+	for (int i = 2; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-s" && i+1 < argc && sscanf(argv[i+1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+			i++;
+		else if (arg == "-n" && i+1 < argc && (frames = atoi(argv[i+1])) > 0)
+			i++;
+		else if (arg == "-o" && i+1 < argc)
+			output = argv[++i];
+		else if (arg == "-p" && i+3 < argc)
+		{
+			position = vec3f((float)atof(argv[i+1]), (float)atof(argv[i+2]), (float)atof(argv[i+3]));
+			i += 3;
+		}
+		else if (arg == "-r" && i+3 < argc)
+		{
+			orientation = vec3f((float)atof(argv[i+1]), (float)atof(argv[i+2]), (float)atof(argv[i+3]));
+			i += 3;
+		}
+		else if (arg == "-c")
+			software = true;
+		else if (arg == "-t")
+			software = traced = true;
+		else if (arg.size() > 0 && arg[0] != '-')
+			sources.push_back(arg);
+		else
+		{
+			headless_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	working_directory = string(argv[0]).substr(0, string(argv[0]).find_last_of("/\\") + 1);
+
+	headlesshdl context;
+	canvashdl canvas;
+	raytracerhdl raytracer;
+	if (software && (width > canvashdl::max_size || height > canvashdl::max_size))
+	{
+		cerr << "Error: The software renderer can't draw frames larger than " << canvashdl::max_size << "x" << canvashdl::max_size << "." << endl;
+		return 1;
+	}
+	else if (software)
+		canvas.resize(width, height);
+	else if (!context.open(width, height))
+		return 1;
+	else
+		glEnable(GL_DEPTH_TEST);
+
+	scenehdl *scene = new scenehdl();
+	for (unsigned int i = 0; i < sources.size(); i++)
+	{
+		objecthdl *object = NULL;
+		if (sources[i] == "box")
+			object = new boxhdl(1.0, 1.0, 1.0);
+		else if (sources[i] == "cylinder")
+			object = new cylinderhdl(1.0, 1.0, 20);
+		else if (sources[i] == "sphere")
+			object = new spherehdl(1.0, 10, 20);
+		else if (sources[i] == "pyramid")
+			object = new pyramidhdl(1.0, 1.0, 20);
+		else
+		{
+			modelhdl *model = new modelhdl(sources[i]);
+			if (model->rigid.size() == 0)
+				cerr << "Warning: " << sources[i] << " has no geometry." << endl;
+
+			// Models without a material library are drawn in the
+			// default phong material.
+			for (unsigned int j = 0; j < model->rigid.size(); j++)
+				if (model->material.find(model->rigid[j].material) == model->material.end() || model->material[model->rigid[j].material] == NULL)
+					model->material[model->rigid[j].material] = new phonghdl();
+
+			object = model;
+		}
+		scene->objects.push_back(object);
+	}
+
+	// The light only needs a model for its direction, which points
+	// into the scene from above and to the left of the camera.
+	scene->objects.push_back(new objecthdl());
+	scene->objects.back()->orientation = vec3f(0.6f, m_pi - 0.4f, 0.0f);
+	scene->lights.push_back(new directionalhdl());
+	scene->lights.back()->model = scene->objects.back();
+
+	// The camera's model is given the orientation that
+	// camerahdl::update_view() writes back into it every frame.
+	scene->objects.push_back(new objecthdl());
+	scene->objects.back()->orientation = orientation;
+	scene->objects.back()->orientation[0] *= -1;
+	frustumhdl *camera = new frustumhdl();
+	camera->left = -(float)width/(float)height;
+	camera->right = (float)width/(float)height;
+	camera->position = position;
+	camera->orientation = orientation;
+	camera->model = scene->objects.back();
+	scene->cameras.push_back(camera);
+	scene->active_camera = 0;
+	if (!software)
+		camera->project();
+
+	double total = 0.0;
+	bool saved = true;
+	for (int f = 0; f < frames && saved; f++)
+	{
+		timeval start, end;
+		gettimeofday(&start, NULL);
+
+		if (software)
+		{
+			canvas.clear(vec3f(0.0f, 0.0f, 0.0f));
+			if (traced)
+				raytracer.draw(scene, canvas);
+			else
+				canvas.draw(scene);
+		}
+		else
+		{
+			glClearColor(0.0, 0.0, 0.0, 1.0);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			scene->draw();
+			glFinish();
+		}
+
+		gettimeofday(&end, NULL);
+		total += (double)(end.tv_sec - start.tv_sec)*1000.0 + (double)(end.tv_usec - start.tv_usec)/1000.0;
+
+		ostringstream filename;
+		filename << output << setw(4) << setfill('0') << f << ".png";
+		saved = (software ? canvas.save(filename.str()) : context.save(filename.str()));
+	}
+
+	if (saved)
+		cout << "Status: Rendered " << frames << " frames at " << width << "x" << height << " in " << total/(double)frames << " ms per frame, " << 1000.0*(double)frames/total << " frames per second" << endl;
+
+	if (saved && traced)
+		cout << "Status: Traced " << (double)raytracer.rays*(double)frames*1000.0/total << " rays per second" << endl;
+
+	delete scene;
+	if (!software)
+		context.close();
+	return saved ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+/*
+ * headless.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "standard.h"
+#include "opengl.h"
+
+#ifndef headless_h
+#define headless_h
+
+/* An OpenGL context that isn't attached to any window, along with
+ * a framebuffer object to draw into. This is how frames get rendered
+ * on machines with no display server. On Linux it goes through EGL,
+ * using Mesa's surfaceless platform when it is there, so it also
+ * works with the llvmpipe software renderer and no GPU at all.
+ */
+struct headlesshdl
+{
+	headlesshdl();
+	~headlesshdl();
+
+	// The EGL display, context and surface. These are kept as void
+	// pointers so that this header doesn't pull in the EGL headers.
+	void *display;
+	void *context;
+	void *surface;
+
+	int width, height;
+	GLuint framebuffer;
+	GLuint renderbuffer[2];
+
+	bool open(int width, int height);
+	void close();
+	bool save(string filename);
+};
+
+int headless_main(int argc, char **argv);
+
+#endif
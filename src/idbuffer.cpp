@@ -0,0 +1,280 @@
+/*
+ * idbuffer.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "idbuffer.h"
+#include "scene.h"
+#include "object.h"
+#include "camera.h"
+
+GLuint idbufferhdl::vertex = 0;
+GLuint idbufferhdl::fragment = 0;
+GLuint idbufferhdl::program = 0;
+programhdl idbufferhdl::uniforms;
+
+extern string working_directory;
+
+idbufferhdl::idbufferhdl()
+{
+	framebuffer = 0;
+	renderbuffer[0] = 0;
+	renderbuffer[1] = 0;
+	for (int i = 0; i < slots; i++)
+	{
+		pixel_buffer[i] = 0;
+		fence[i] = 0;
+	}
+	next = 0;
+	object = -1;
+	rigid = -1;
+}
+
+idbufferhdl::~idbufferhdl()
+{
+}
+
+/* supported
+ *
+ * Check whether the context has what the id buffer needs: integer
+ * color buffers, mapped buffer ranges and GLSL 1.30 from OpenGL 3.0,
+ * and sync objects, which are core from 3.2 on.
+ */
+bool idbufferhdl::supported()
+{
+#ifdef __GLEW_H__
+	return GLEW_VERSION_3_0 && GLEW_ARB_sync;
+#else
+	const char *version = (const char*)glGetString(GL_VERSION);
+	if (version == NULL)
+		return false;
+
+	int major = 0, minor = 0;
+	char dot = 0;
+	istringstream in(version);
+	in >> major >> dot >> minor;
+	return major > 3 || (major == 3 && minor >= 2);
+#endif
+}
+
+/* create
+ *
+ * Make the program, the framebuffer and the pixel buffers if they
+ * don't exist yet.
+ */
+void idbufferhdl::create()
+{
+	if (program == 0)
+	{
+		vertex = load_shader_file(working_directory + "res/id.vx", GL_VERTEX_SHADER);
+		fragment = load_shader_file(working_directory + "res/id.ft", GL_FRAGMENT_SHADER);
+		program = link_program(vertex, fragment);
+		uniforms.reflect(program);
+	}
+
+	if (framebuffer == 0)
+	{
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(2, renderbuffer);
+		glGenBuffers(slots, pixel_buffer);
+		for (int i = 0; i < slots; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 2*sizeof(GLuint), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32UI, 1, 1);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 1, 1);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer[1]);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cerr << "Error: The id buffer is incomplete." << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	}
+}
+
+/* draw
+ *
+ * Draw the ids of the pixel at (x, y), counted from the top left of
+ * the viewport like the mouse, and start reading it back. This has
+ * to come right after scenehdl::draw() so that the matrices and the
+ * levels of detail are the ones that were just drawn.
+ */
+void idbufferhdl::draw(scenehdl *scene, int x, int y)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if (!scene->active_camera_valid() || x < 0 || y < 0 || x >= viewport[2] || y >= viewport[3])
+		return;
+
+	create();
+
+	// A read that is still in flight in this slot is dropped, the
+	// newer one is more useful anyway.
+	if (fence[next] != 0)
+		glDeleteSync(fence[next]);
+	fence[next] = 0;
+
+	camerahdl *camera = scene->cameras[scene->active_camera];
+	const mat4f &view = camera->view_matrix;
+
+	// Stretch the pixel over the whole of clip space, so that the
+	// frustum only holds what lands on it and a one pixel viewport
+	// samples its center.
+	mat4f pixel = identity<float, 4, 4>();
+	pixel[0][0] = (float)viewport[2];
+	pixel[0][3] = (float)(viewport[2] - 1 - 2*x);
+	pixel[1][1] = (float)viewport[3];
+	pixel[1][3] = (float)(2*y + 1 - viewport[3]);
+	mat4f projection = pixel*camera->projection_matrix;
+
+	// Leave the count of culled objects to the frame.
+	int culled = scene->culled;
+	vector<int> &drawn = indices[next];
+	drawn = scene->visible(projection*view);
+	scene->culled = culled;
+	objects[next].resize(drawn.size());
+
+	GLint previous = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, 1, 1);
+	GLuint background[4] = {0, 0, 0, 0};
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadTransposeMatrixf((const float*)projection.data);
+	glMatrixMode(GL_MODELVIEW);
+
+	glUseProgram(program);
+	for (unsigned int k = 0; k < drawn.size(); k++)
+	{
+		objecthdl *o = scene->objects[drawn[k]];
+		objects[next][k] = o;
+
+		mat4f modelview = view*o->world_matrix();
+		glLoadTransposeMatrixf((const float*)modelview.data);
+		for (unsigned int j = 0; j < o->rigid.size(); j++)
+		{
+			glUniform2ui(uniforms.location[uniform_id], k+1, j+1);
+			o->rigid[j].draw(&uniforms);
+		}
+	}
+	glUseProgram(0);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer[next]);
+	glReadPixels(0, 0, 1, 1, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fence[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glMatrixMode(GL_PROJECTION);
+	glLoadTransposeMatrixf((const float*)camera->projection_matrix.data);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadTransposeMatrixf((const float*)view.data);
+
+	next = (next + 1)%slots;
+}
+
+/* read
+ *
+ * Collect the reads that the GPU has finished without waiting for
+ * the rest, and return true if 'object' and 'rigid' were updated.
+ * Reads of objects that have since left the scene or moved to another
+ * index come back as nothing under the mouse.
+ */
+bool idbufferhdl::read(scenehdl *scene)
+{
+	bool updated = false;
+	for (int i = 0; i < slots; i++)
+	{
+		int s = (next + i)%slots;
+		if (fence[s] == 0)
+			continue;
+
+		// The GPU finishes them in order, so the newer ones can't be
+		// done either.
+		if (glClientWaitSync(fence[s], 0, 0) == GL_TIMEOUT_EXPIRED)
+			break;
+
+		glDeleteSync(fence[s]);
+		fence[s] = 0;
+
+		GLuint id[2] = {0, 0};
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer[s]);
+		GLuint *data = (GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(id), GL_MAP_READ_BIT);
+		if (data != NULL)
+		{
+			id[0] = data[0];
+			id[1] = data[1];
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		object = -1;
+		rigid = -1;
+		if (id[0] > 0 && id[0] <= indices[s].size())
+		{
+			int index = indices[s][id[0]-1];
+			objecthdl *o = objects[s][id[0]-1];
+			if (index < (int)scene->objects.size() && scene->objects[index] == o && id[1] <= o->rigid.size())
+			{
+				object = index;
+				rigid = (int)id[1]-1;
+			}
+		}
+		updated = true;
+	}
+
+	return updated;
+}
+
+/* waiting
+ *
+ * Check whether any reads haven't come back yet.
+ */
+bool idbufferhdl::waiting()
+{
+	for (int i = 0; i < slots; i++)
+		if (fence[i] != 0)
+			return true;
+	return false;
+}
+
+/* release
+ *
+ * Delete the framebuffer and the pixel buffers.
+ */
+void idbufferhdl::release()
+{
+	for (int i = 0; i < slots; i++)
+	{
+		if (fence[i] != 0)
+			glDeleteSync(fence[i]);
+		fence[i] = 0;
+	}
+
+	if (framebuffer != 0)
+	{
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(2, renderbuffer);
+		glDeleteBuffers(slots, pixel_buffer);
+	}
+	framebuffer = 0;
+	renderbuffer[0] = 0;
+	renderbuffer[1] = 0;
+	for (int i = 0; i < slots; i++)
+		pixel_buffer[i] = 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * idbuffer.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include "opengl.h"
+
+using namespace core;
+
+#ifndef idbuffer_h
+#define idbuffer_h
+
+struct scenehdl;
+struct objecthdl;
+
+/* This picks on the GPU instead of casting rays through the scene
+ * like pickhdl. The frustum is narrowed down to the one pixel under
+ * the mouse, like gluPickMatrix, so the tree of the scene only finds
+ * the objects that reach that pixel. Those are drawn again through
+ * that frustum into a one pixel integer framebuffer with a program
+ * that writes the index of the object and of the rigid body. They
+ * keep the levels of detail, polygon mode and face culling of the
+ * frame that was just drawn, so the result is whatever is on screen
+ * there, except for the odd edge that passes right through the
+ * center of the pixel.
+ *
+ * The pixel is copied into a pixel buffer object along with a fence,
+ * and read() only maps it once the fence has passed, usually on the
+ * next frame. Nothing ever waits on the GPU, at the cost of results
+ * arriving a frame late. All of this needs OpenGL 3.0 and sync
+ * objects, see supported().
+ */
+struct idbufferhdl
+{
+	idbufferhdl();
+	~idbufferhdl();
+
+	enum
+	{
+		slots = 2
+	};
+
+	// An unsigned two channel color buffer and a depth buffer of
+	// one pixel.
+	GLuint framebuffer;
+	GLuint renderbuffer[2];
+
+	// The reads in flight, oldest first starting from 'next'. Each
+	// one remembers the scene index and the address of every object
+	// that it drew, so that a read can be thrown out if the objects
+	// changed in the meantime.
+	GLuint pixel_buffer[slots];
+	GLsync fence[slots];
+	vector<int> indices[slots];
+	vector<objecthdl*> objects[slots];
+	int next;
+
+	// The last read to come back, -1 if nothing was under the mouse.
+	int object;
+	int rigid;
+
+	static GLuint vertex;
+	static GLuint fragment;
+	static GLuint program;
+	static programhdl uniforms;
+
+	static bool supported();
+
+	void draw(scenehdl *scene, int x, int y);
+	bool read(scenehdl *scene);
+	bool waiting();
+	void release();
+
+private:
+	void create();
+};
+
+#endif
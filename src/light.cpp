@@ -9,6 +9,146 @@
 #include "object.h"
 #include "opengl.h"
 
+/* store
+ *
+ * Copy a vec3f into one of the light block's vec3 slots.
+ */
+static void store(float *result, const vec3f &value)
+{
+	result[0] = value[0];
+	result[1] = value[1];
+	result[2] = value[2];
+}
+
+/* eye_position
+ *
+ * Find the eye space position of the origin of a model given
+ * its world matrix and the camera's view matrix.
+ */
+static vec3f eye_position(const mat4f &view, const mat4f &world)
+{
+	vec3f result;
+	for (int i = 0; i < 3; i++)
+		result[i] = view[i][0]*world[0][3] + view[i][1]*world[1][3] + view[i][2]*world[2][3] + view[i][3];
+	return result;
+}
+
+/* eye_direction
+ *
+ * Find the eye space direction of the -z axis of a model given
+ * its world matrix and the camera's view matrix. Both are made
+ * of rotations and uniform scales, so their inverse transpose
+ * points the same way as they do.
+ */
+static vec3f eye_direction(const mat4f &view, const mat4f &world)
+{
+	vec3f result;
+	for (int i = 0; i < 3; i++)
+		result[i] = -(view[i][0]*world[0][2] + view[i][1]*world[1][2] + view[i][2]*world[2][2]);
+	return norm(result);
+}
+
+/* shade
+ *
+ * The lighting() function of res/light.glsl, for renderers that
+ * don't use the shaders. 'vertex' and 'normal' are in eye space and
+ * the normal has unit length.
+ */
+vec3f lightblockhdl::shade(const vec3f &emission, const vec3f &ambient, const vec3f &diffuse, const vec3f &specular, float shininess, const vec3f &vertex, const vec3f &normal) const
+{
+	vec3f light_ambient(0.0f, 0.0f, 0.0f);
+	vec3f light_diffuse(0.0f, 0.0f, 0.0f);
+	vec3f light_specular(0.0f, 0.0f, 0.0f);
+
+	vec3f eye_direction = -vertex;
+	float eye_distance = mag(eye_direction);
+	if (eye_distance > 0.0f)
+		eye_direction /= eye_distance;
+
+	for (int j = 0; j < num_dlights; j++)
+	{
+		vec3f direction(dlights[j].direction[0], dlights[j].direction[1], dlights[j].direction[2]);
+		vec3f half_vector = norm(direction + eye_direction);
+
+		float normal_dot_light_direction = max(0.0f, dot(normal, direction));
+		float normal_dot_half_vector = max(0.0f, dot(normal, half_vector));
+
+		float power_factor = 0.0f;
+		if (normal_dot_light_direction > 0.0f)
+			power_factor = powf(normal_dot_half_vector, shininess);
+
+		for (int i = 0; i < 3; i++)
+		{
+			light_ambient[i] += dlights[j].ambient[i];
+			light_diffuse[i] += dlights[j].diffuse[i]*normal_dot_light_direction;
+			light_specular[i] += dlights[j].specular[i]*power_factor;
+		}
+	}
+
+	for (int j = 0; j < num_plights; j++)
+	{
+		vec3f light_direction = vec3f(plights[j].position[0], plights[j].position[1], plights[j].position[2]) - vertex;
+		float light_distance = mag(light_direction);
+		light_direction /= light_distance;
+
+		const float *attenuation = plights[j].attenuation;
+		float att = 1.0f/(attenuation[0] + attenuation[1]*light_distance + attenuation[2]*light_distance*light_distance);
+
+		vec3f half_vector = norm(light_direction + eye_direction);
+
+		float normal_dot_light_direction = max(0.0f, dot(normal, light_direction));
+		float normal_dot_half_vector = max(0.0f, dot(normal, half_vector));
+
+		float power_factor = 0.0f;
+		if (normal_dot_light_direction > 0.0f)
+			power_factor = powf(normal_dot_half_vector, shininess);
+
+		for (int i = 0; i < 3; i++)
+		{
+			light_ambient[i] += plights[j].ambient[i]*att;
+			light_diffuse[i] += plights[j].diffuse[i]*normal_dot_light_direction*att;
+			light_specular[i] += plights[j].specular[i]*power_factor*att;
+		}
+	}
+
+	for (int j = 0; j < num_slights; j++)
+	{
+		vec3f light_direction = vec3f(slights[j].position[0], slights[j].position[1], slights[j].position[2]) - vertex;
+		float light_distance = mag(light_direction);
+		light_direction /= light_distance;
+
+		const float *attenuation = slights[j].attenuation;
+		float att = 1.0f/(attenuation[0] + attenuation[1]*light_distance + attenuation[2]*light_distance*light_distance);
+		float spotdot = -dot(light_direction, vec3f(slights[j].direction[0], slights[j].direction[1], slights[j].direction[2]));
+
+		float spotatt = 0.0f;
+		if (spotdot >= slights[j].cutoff)
+			spotatt = powf(spotdot, slights[j].exponent);
+
+		att *= spotatt;
+
+		vec3f half_vector = norm(light_direction + eye_direction);
+		float normal_dot_light_direction = max(0.0f, dot(normal, light_direction));
+		float normal_dot_half_vector = max(0.0f, dot(normal, half_vector));
+
+		float power_factor = 0.0f;
+		if (normal_dot_light_direction > 0.0f)
+			power_factor = powf(normal_dot_half_vector, shininess);
+
+		for (int i = 0; i < 3; i++)
+		{
+			light_ambient[i] += slights[j].ambient[i]*att;
+			light_diffuse[i] += slights[j].diffuse[i]*normal_dot_light_direction*att;
+			light_specular[i] += slights[j].specular[i]*power_factor*att;
+		}
+	}
+
+	vec3f result;
+	for (int i = 0; i < 3; i++)
+		result[i] = core::clamp(emission[i] + ambient[i]*light_ambient[i] + diffuse[i]*light_diffuse[i] + specular[i]*light_specular[i], 0.0f, 1.0f);
+	return result;
+}
+
 lighthdl::lighthdl()
 {
 	model = NULL;
@@ -44,41 +184,22 @@ directionalhdl::~directionalhdl()
 
 }
 
-void directionalhdl::update()
+void directionalhdl::update(const mat4f &view)
 {
-
-	// Set up the modelview matrix
-    if (model != NULL)
-    {
-        glTranslatef(model->position[0], model->position[1], model->position[2]);
-        glRotatef(radtodeg(model->orientation[0]), 1.0, 0.0, 0.0);
-        glRotatef(radtodeg(model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(model->orientation[2]), 0.0, 0.0, 1.0);
-
-        mat4f mv;
-        glGetFloatv(GL_TRANSPOSE_MODELVIEW_MATRIX, (float*)mv.data);
-		direction = transpose(inverse(mv))*vec4f(0.0, 0.0, -1.0, 0.0);
-
-        glRotatef(radtodeg(-model->orientation[2]), 0.0, 0.0, 1.0);
-        glRotatef(radtodeg(-model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(-model->orientation[0]), 1.0, 0.0, 0.0);
-        glTranslatef(-model->position[0], -model->position[1], -model->position[2]);
-    }
+	if (model != NULL)
+		direction = eye_direction(view, model->world_matrix());
 }
 
-void directionalhdl::apply(string name, GLuint program)
+void directionalhdl::apply(lightblockhdl &block)
 {
-    GLuint loc = glGetUniformLocation(program, (name + "ambient").c_str());
-    glUniform3f(loc, ambient[0], ambient[1], ambient[2]);
-
-    loc = glGetUniformLocation(program, (name + "diffuse").c_str());
-    glUniform3f(loc, diffuse[0], diffuse[1], diffuse[2]);
-
-    loc = glGetUniformLocation(program, (name + "specular").c_str());
-    glUniform3f(loc, specular[0], specular[1], specular[2]);
-
-    loc = glGetUniformLocation(program, (name + "direction").c_str());
-    glUniform3f(loc, direction[0], direction[1], direction[2]);
+	if (block.num_dlights >= max_lights)
+		return;
+
+	store(block.dlights[block.num_dlights].ambient, ambient);
+	store(block.dlights[block.num_dlights].diffuse, diffuse);
+	store(block.dlights[block.num_dlights].specular, specular);
+	store(block.dlights[block.num_dlights].direction, direction);
+	block.num_dlights++;
 }
 
 pointhdl::pointhdl() : lighthdl(white*0.1f, white*0.5f, white)
@@ -98,45 +219,23 @@ pointhdl::~pointhdl()
 
 }
 
-void pointhdl::update()
+void pointhdl::update(const mat4f &view)
 {
 	if (model != NULL)
-	{
-        glTranslatef(model->position[0], model->position[1], model->position[2]);
-        glRotatef(radtodeg(model->orientation[0]), 1.0, 0.0, 0.0);
-        glRotatef(radtodeg(model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(model->orientation[2]), 0.0, 0.0, 1.0);
-
-        mat4f mv;
-        glGetFloatv(GL_TRANSPOSE_MODELVIEW_MATRIX, (float*)mv.data);
-
-		vec4f p = mv*vec4f(0.0, 0.0, 0.0, 1.0);
-		position = p(0,3)/p[3];
-
-        glRotatef(radtodeg(-model->orientation[2]), 0.0, 0.0, 1.0);
-        glRotatef(radtodeg(-model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(-model->orientation[0]), 1.0, 0.0, 0.0);
-        glTranslatef(-model->position[0], -model->position[1], -model->position[2]);
-	}
+		position = eye_position(view, model->world_matrix());
 }
 
-void pointhdl::apply(string name, GLuint program)
+void pointhdl::apply(lightblockhdl &block)
 {
-    GLuint loc = glGetUniformLocation(program, (name + "ambient").c_str());
-    glUniform3f(loc, ambient[0], ambient[1], ambient[2]);
-
-    loc = glGetUniformLocation(program, (name + "diffuse").c_str());
-    glUniform3f(loc, diffuse[0], diffuse[1], diffuse[2]);
-
-    loc = glGetUniformLocation(program, (name + "specular").c_str());
-    glUniform3f(loc, specular[0], specular[1], specular[2]);
-
-    loc = glGetUniformLocation(program, (name + "attenuation").c_str());
-    glUniform3f(loc, attenuation[0], attenuation[1], attenuation[2]);
-
-    loc = glGetUniformLocation(program, (name + "position").c_str());
-    glUniform3f(loc, position[0], position[1], position[2]);
-
+	if (block.num_plights >= max_lights)
+		return;
+
+	store(block.plights[block.num_plights].ambient, ambient);
+	store(block.plights[block.num_plights].diffuse, diffuse);
+	store(block.plights[block.num_plights].specular, specular);
+	store(block.plights[block.num_plights].attenuation, attenuation);
+	store(block.plights[block.num_plights].position, position);
+	block.num_plights++;
 }
 
 spothdl::spothdl() : lighthdl(white*0.1f, white*0.5f, white)
@@ -160,51 +259,27 @@ spothdl::~spothdl()
 
 }
 
-void spothdl::update()
+void spothdl::update(const mat4f &view)
 {
 	if (model != NULL)
 	{
-        glTranslatef(model->position[0], model->position[1], model->position[2]);
-        glRotatef(radtodeg(model->orientation[0]), 1.0, 0.0, 0.0);
-        glRotatef(radtodeg(model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(model->orientation[2]), 0.0, 0.0, 1.0);
-
-        mat4f mv;
-        glGetFloatv(GL_TRANSPOSE_MODELVIEW_MATRIX, (float*)mv.data);
-		vec4f p = mv*vec4f(0.0, 0.0, 0.0, 1.0);
-		position = p(0,3)/p[3];
-		direction = transpose(inverse(mv))*vec4f(0.0, 0.0, -1.0, 0.0);
-
-        glRotatef(radtodeg(-model->orientation[2]), 0.0, 0.0, 1.0);
-        glRotatef(radtodeg(-model->orientation[1]), 0.0, 1.0, 0.0);
-        glRotatef(radtodeg(-model->orientation[0]), 1.0, 0.0, 0.0);
-        glTranslatef(-model->position[0], -model->position[1], -model->position[2]);
+		position = eye_position(view, model->world_matrix());
+		direction = eye_direction(view, model->world_matrix());
 	}
 }
 
-void spothdl::apply(string name, GLuint program)
+void spothdl::apply(lightblockhdl &block)
 {
-    GLuint loc = glGetUniformLocation(program, (name + "ambient").c_str());
-    glUniform3f(loc, ambient[0], ambient[1], ambient[2]);
-
-    loc = glGetUniformLocation(program, (name + "diffuse").c_str());
-    glUniform3f(loc, diffuse[0], diffuse[1], diffuse[2]);
-
-    loc = glGetUniformLocation(program, (name + "specular").c_str());
-    glUniform3f(loc, specular[0], specular[1], specular[2]);
-
-    loc = glGetUniformLocation(program, (name + "attenuation").c_str());
-    glUniform3f(loc, attenuation[0], attenuation[1], attenuation[2]);
-
-    loc = glGetUniformLocation(program, (name + "position").c_str());
-    glUniform3f(loc, position[0], position[1], position[2]);
-
-    loc = glGetUniformLocation(program, (name + "cutoff").c_str());
-    glUniform1f(loc, cutoff);
-
-    loc = glGetUniformLocation(program, (name + "exponent").c_str());
-    glUniform1f(loc, exponent);
-
-    loc = glGetUniformLocation(program, (name + "direction").c_str());
-    glUniform3f(loc, direction[0], direction[1], direction[2]);
+	if (block.num_slights >= max_lights)
+		return;
+
+	store(block.slights[block.num_slights].ambient, ambient);
+	store(block.slights[block.num_slights].diffuse, diffuse);
+	store(block.slights[block.num_slights].specular, specular);
+	store(block.slights[block.num_slights].attenuation, attenuation);
+	block.slights[block.num_slights].cutoff = cutoff;
+	block.slights[block.num_slights].exponent = exponent;
+	store(block.slights[block.num_slights].position, position);
+	store(block.slights[block.num_slights].direction, direction);
+	block.num_slights++;
 }
@@ -17,6 +17,50 @@ using namespace core;
 struct objecthdl;
 struct canvashdl;
 
+/* This mirrors the std140 layout of the lights block in
+ * res/light.glsl so that it can be copied straight into the
+ * uniform buffer. Every vec3 takes up four floats.
+ */
+struct lightblockhdl
+{
+	int num_dlights;
+	int num_plights;
+	int num_slights;
+	int padding;
+
+	struct
+	{
+		float ambient[4];
+		float diffuse[4];
+		float specular[4];
+		float direction[4];
+	} dlights[max_lights];
+
+	struct
+	{
+		float ambient[4];
+		float diffuse[4];
+		float specular[4];
+		float attenuation[4];
+		float position[4];
+	} plights[max_lights];
+
+	struct
+	{
+		float ambient[4];
+		float diffuse[4];
+		float specular[4];
+		float attenuation[3];
+		float cutoff;
+		float exponent;
+		float padding[3];
+		float position[4];
+		float direction[4];
+	} slights[max_lights];
+
+	vec3f shade(const vec3f &emission, const vec3f &ambient, const vec3f &diffuse, const vec3f &specular, float shininess, const vec3f &vertex, const vec3f &normal) const;
+};
+
 struct lighthdl
 {
 	lighthdl();
@@ -31,8 +75,8 @@ struct lighthdl
 	vec3f diffuse;
 	vec3f specular;
 
-	virtual void update() = 0;
-	virtual void apply(string name, GLuint program) = 0;
+	virtual void update(const mat4f &view) = 0;
+	virtual void apply(lightblockhdl &block) = 0;
 };
 
 struct directionalhdl : lighthdl
@@ -44,8 +88,8 @@ struct directionalhdl : lighthdl
 	// Updated
 	vec3f direction;
 
-	void update();
-	void apply(string name, GLuint program);
+	void update(const mat4f &view);
+	void apply(lightblockhdl &block);
 };
 
 struct pointhdl : lighthdl
@@ -60,8 +104,8 @@ struct pointhdl : lighthdl
 	// Updated
 	vec3f position;
 
-	void update();
-	void apply(string name, GLuint program);
+	void update(const mat4f &view);
+	void apply(lightblockhdl &block);
 };
 
 struct spothdl : lighthdl
@@ -79,8 +123,8 @@ struct spothdl : lighthdl
 	vec3f position;
 	vec3f direction;
 
-	void update();
-	void apply(string name, GLuint program);
+	void update(const mat4f &view);
+	void apply(lightblockhdl &block);
 };
 
 #endif
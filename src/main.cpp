@@ -13,10 +13,22 @@
 #include "primitive.h"
 #include "tinyfiledialogs.h"
 #include "light.h"
+#include "headless.h"
+#include "pick.h"
+#include "idbuffer.h"
 
 int window_id;
 
 scenehdl scene;
+pickhdl picker;
+idbufferhdl ids;
+
+// Whether the object under the mouse is found by casting a ray
+// through the triangles or by reading the id buffer back from the
+// GPU, and the pixel that the id buffer should draw next, if any.
+bool pick_gpu = false;
+bool pick_requested = false;
+int pickx = 0, picky = 0;
 
 int mousex = 0, mousey = 0;
 bool bound = false;
@@ -61,13 +73,16 @@ void init()
 	scene.cameras.push_back(new frustumhdl());
 	scene.objects.push_back(new pyramidhdl(1.0, 1.0, 8));
 	for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-		for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+	{
+		meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+		for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 		{
-			swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-			scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-			swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-			scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+			swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+			mesh.geometry[i][1] *= -1.0;
+			swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+			mesh.geometry[i][4] *= -1.0;
 		}
+	}
 	swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 	swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 
@@ -82,13 +97,49 @@ void init()
 	glEnable(GL_DEPTH_TEST);
 }
 
+void select_object(int object)
+{
+	if (object == scene.active_object)
+		return;
+
+	// The roles of the objects were updated by the last scenehdl::update().
+	scene.active_object = object;
+	glutDetachMenu(GLUT_RIGHT_BUTTON);
+	if (scene.active_object == -1)
+		glutSetMenu(canvas_menu_id);
+	else if (scene.objects[scene.active_object]->is_light)
+		glutSetMenu(light_menu_id);
+	else if (scene.objects[scene.active_object]->is_camera)
+		glutSetMenu(camera_menu_id);
+	else
+		glutSetMenu(object_menu_id);
+	glutAttachMenu(GLUT_RIGHT_BUTTON);
+	glutPostRedisplay();
+}
+
 void displayfunc()
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	scene.draw();
 
+	if (pick_gpu)
+	{
+		if (ids.read(&scene))
+			select_object(ids.object);
+
+		if (pick_requested)
+		{
+			ids.draw(&scene, pickx, picky);
+			pick_requested = false;
+		}
+	}
+
 	glutSwapBuffers();
+
+	// Keep drawing until the last read comes back.
+	if (pick_gpu && ids.waiting())
+		glutPostRedisplay();
 }
 
 void reshapefunc(int w, int h)
@@ -135,113 +186,36 @@ void pmotionfunc(int x, int y)
 
 		glutPostRedisplay();
 	}
+	else if (pick_gpu)
+	{
+		pickx = x;
+		picky = y;
+		pick_requested = true;
+		glutPostRedisplay();
+	}
 	else if (scene.active_camera_valid())
 	{
-		vec3f direction;
-		vec3f position;
-
-		if (scene.active_camera_valid())
+		// The ray runs from the near plane to the far plane under the
+		// mouse, which works the same for every kind of projection.
+		// It comes from the matrices of the camera rather than from
+		// OpenGL, whose modelview was left with the last object drawn.
+		camerahdl *camera = scene.cameras[scene.active_camera];
+		float nx = ((float)x + 0.5f)/(float)width*2.0f - 1.0f;
+		float ny = 1.0f - ((float)y + 0.5f)/(float)height*2.0f;
+		vec3f near = unproject(camera->projection_matrix, nx, ny, -1.0f);
+		vec3f far = unproject(camera->projection_matrix, nx, ny, 1.0f);
+
+		mat4f inverse;
+		affine_inverse(camera->view_matrix, inverse);
+		vec3f position, direction;
+		for (int i = 0; i < 3; i++)
 		{
-			if (scene.cameras[scene.active_camera]->type == "ortho")
-			{
-				GLdouble model[16];
-				GLdouble proj[16];
-				GLint view[4];
-				glGetDoublev(GL_MODELVIEW_MATRIX, model);
-				glGetDoublev(GL_PROJECTION_MATRIX, proj);
-				glGetIntegerv(GL_VIEWPORT, view);
-				vec<double, 3> p;
-				gluUnProject(x, height-y, 0.0f, model, proj, view, &p[0], &p[1], &p[2]);
-				position = p;
-				direction = ror3(vec3f(0.0f, 0.0f, 1.0f), scene.cameras[scene.active_camera]->orientation);
-			}
-			else
-			{
-				GLdouble model[16];
-				GLdouble proj[16];
-				GLint view[4];
-				glGetDoublev(GL_MODELVIEW_MATRIX, model);
-				glGetDoublev(GL_PROJECTION_MATRIX, proj);
-				glGetIntegerv(GL_VIEWPORT, view);
-				vec<double, 3> p;
-				gluUnProject(x, height-y, 0.0f, model, proj, view, &p[0], &p[1], &p[2]);
-				position = scene.cameras[scene.active_camera]->position;
-				direction = norm(p - position);
-			}
+			position[i] = inverse[i][0]*near[0] + inverse[i][1]*near[1] + inverse[i][2]*near[2] + inverse[i][3];
+			direction[i] = inverse[i][0]*(far[0] - near[0]) + inverse[i][1]*(far[1] - near[1]) + inverse[i][2]*(far[2] - near[2]);
 		}
+		direction = norm(direction);
 
-		int old_active_object = scene.active_object;
-		scene.active_object = -1;
-		for (unsigned int i = 0; i < scene.objects.size(); i++)
-		{
-			if (scene.objects[i] != NULL && scene.cameras[scene.active_camera]->model != scene.objects[i])
-			{
-				bool is_light = false;
-				bool is_camera = false;
-
-				for (unsigned int j = 0; j < scene.lights.size() && !is_light; j++)
-					if (scene.lights[j] != NULL && scene.lights[j]->model == scene.objects[i])
-						is_light = true;
-
-				for (unsigned int j = 0; j < scene.cameras.size() && !is_camera; j++)
-					if (scene.cameras[j] != NULL && scene.cameras[j]->model == scene.objects[i])
-						is_camera = true;
-
-				if ((!is_light && !is_camera) || (is_light && scene.render_lights) || (is_camera && scene.render_cameras))
-				{
-					vec3f invdir = 1.0f/direction;
-					vec3i sign((int)(invdir[0] < 0), (int)(invdir[1] < 0), (int)(invdir[2] < 0));
-					vec3f origin = position - scene.objects[i]->position;
-					float tmin, tmax, tymin, tymax, tzmin, tzmax;
-					tmin = (scene.objects[i]->bound[0 + sign[0]]*scene.objects[i]->scale - origin[0])*invdir[0];
-					tmax = (scene.objects[i]->bound[0 + 1-sign[0]]*scene.objects[i]->scale - origin[0])*invdir[0];
-					tymin = (scene.objects[i]->bound[2 + sign[1]]*scene.objects[i]->scale - origin[1])*invdir[1];
-					tymax = (scene.objects[i]->bound[2 + 1-sign[1]]*scene.objects[i]->scale - origin[1])*invdir[1];
-					if ((tmin <= tymax) && (tymin <= tmax))
-					{
-						if (tymin > tmin)
-							tmin = tymin;
-						if (tymax < tmax)
-							tmax = tymax;
-
-						tzmin = (scene.objects[i]->bound[4 + sign[2]]*scene.objects[i]->scale - origin[2])*invdir[2];
-						tzmax = (scene.objects[i]->bound[4 + 1-sign[2]]*scene.objects[i]->scale - origin[2])*invdir[2];
-
-						if ((tmin <= tzmax) && (tzmin <= tmax))
-						{
-							scene.active_object = i;
-							i = scene.objects.size();
-						}
-					}
-				}
-			}
-		}
-
-		if (scene.active_object != old_active_object)
-		{
-			bool is_light = false;
-			bool is_camera = false;
-
-			for (unsigned int i = 0; i < scene.lights.size() && !is_light; i++)
-				if (scene.lights[i] != NULL && scene.active_object_valid() && scene.lights[i]->model == scene.objects[scene.active_object])
-					is_light = true;
-
-			for (unsigned int i = 0; i < scene.cameras.size() && !is_camera; i++)
-				if (scene.cameras[i] != NULL && scene.active_object_valid() && scene.cameras[i]->model == scene.objects[scene.active_object])
-					is_camera = true;
-
-			glutDetachMenu(GLUT_RIGHT_BUTTON);
-			if (scene.active_object == -1)
-				glutSetMenu(canvas_menu_id);
-			else if (is_light)
-				glutSetMenu(light_menu_id);
-			else if (is_camera)
-				glutSetMenu(camera_menu_id);
-			else
-				glutSetMenu(object_menu_id);
-			glutAttachMenu(GLUT_RIGHT_BUTTON);
-			glutPostRedisplay();
-		}
+		select_object(picker.pick(&scene, position, direction));
 	}
 }
 
@@ -376,6 +350,7 @@ void keydownfunc(unsigned char key, int x, int y)
 
 	if (key == 27) // Escape Key Pressed
 	{
+		ids.release();
 		glutDestroyWindow(window_id);
 		exit(0);
 	}
@@ -450,6 +425,9 @@ void idlefunc()
 		}
 	}
 
+	if (scene.update_loading())
+		change = true;
+
 	if (change)
 		glutPostRedisplay();
 }
@@ -463,7 +441,10 @@ void menustatusfunc(int status, int x, int y)
 void canvas_menu(int num)
 {
 	if (num == 0)
+	{
+		ids.release();
 		exit(0);
+	}
 	else if (num == 1)
 		scene.objects.push_back(new boxhdl(1.0, 1.0, 1.0));
 	else if (num == 2)
@@ -478,7 +459,7 @@ void canvas_menu(int num)
 		filters[0] = "*.obj";
 		const char *path = tinyfd_openFileDialog("Load a Model", "", 1, filters, 0);
 		if (path != NULL && strlen(path) > 0)
-			scene.objects.push_back(new modelhdl(path));
+			scene.load(path);
 	}
 	else if (num == 6)
 		scene.render_lights = !scene.render_lights;
@@ -487,13 +468,16 @@ void canvas_menu(int num)
 		scene.lights.push_back(new directionalhdl());
 		scene.objects.push_back(new cylinderhdl(0.25, 1.0, 8));
 		for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-			for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+		{
+			meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+			for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 			{
-				swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-				scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-				swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-				scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+				swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+				mesh.geometry[i][1] *= -1.0;
+				swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+				mesh.geometry[i][4] *= -1.0;
 			}
+		}
 		swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 		swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 		scene.lights.back()->model = scene.objects.back();
@@ -509,13 +493,16 @@ void canvas_menu(int num)
 		scene.lights.push_back(new spothdl());
 		scene.objects.push_back(new pyramidhdl(0.25, 1.0, 8));
 		for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-			for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+		{
+			meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+			for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 			{
-				swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-				scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-				swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-				scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+				swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+				mesh.geometry[i][1] *= -1.0;
+				swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+				mesh.geometry[i][4] *= -1.0;
 			}
+		}
 		swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 		swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 		scene.lights.back()->model = scene.objects.back();
@@ -541,13 +528,16 @@ void canvas_menu(int num)
 		scene.cameras.push_back(new orthohdl());
 		scene.objects.push_back(new pyramidhdl(1.0, 1.0, 8));
 		for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-			for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+		{
+			meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+			for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 			{
-				swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-				scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-				swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-				scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+				swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+				mesh.geometry[i][1] *= -1.0;
+				swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+				mesh.geometry[i][4] *= -1.0;
 			}
+		}
 		swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 		swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 
@@ -563,13 +553,16 @@ void canvas_menu(int num)
 		scene.cameras.push_back(new frustumhdl());
 		scene.objects.push_back(new pyramidhdl(1.0, 1.0, 8));
 		for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-			for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+		{
+			meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+			for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 			{
-				swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-				scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-				swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-				scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+				swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+				mesh.geometry[i][1] *= -1.0;
+				swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+				mesh.geometry[i][4] *= -1.0;
 			}
+		}
 		swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 		swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 
@@ -585,13 +578,16 @@ void canvas_menu(int num)
 		scene.cameras.push_back(new perspectivehdl());
 		scene.objects.push_back(new pyramidhdl(1.0, 1.0, 8));
 		for (unsigned int k = 0; k < scene.objects.back()->rigid.size(); k++)
-			for (unsigned int i = 0; i < scene.objects.back()->rigid[k].geometry.size(); i++)
+		{
+			meshhdl &mesh = scene.objects.back()->rigid[k].edit();
+			for (unsigned int i = 0; i < mesh.geometry.size(); i++)
 			{
-				swap(scene.objects.back()->rigid[k].geometry[i][1], scene.objects.back()->rigid[k].geometry[i][2]);
-				scene.objects.back()->rigid[k].geometry[i][1] *= -1.0;
-				swap(scene.objects.back()->rigid[k].geometry[i][4], scene.objects.back()->rigid[k].geometry[i][5]);
-				scene.objects.back()->rigid[k].geometry[i][4] *= -1.0;
+				swap(mesh.geometry[i][1], mesh.geometry[i][2]);
+				mesh.geometry[i][1] *= -1.0;
+				swap(mesh.geometry[i][4], mesh.geometry[i][5]);
+				mesh.geometry[i][4] *= -1.0;
 			}
+		}
 		swap(scene.objects.back()->bound[2], scene.objects.back()->bound[4]);
 		swap(scene.objects.back()->bound[3], scene.objects.back()->bound[5]);
 
@@ -626,6 +622,14 @@ void canvas_menu(int num)
 		scene.render_normals = scenehdl::face;
 	else if (num == 33)
 		scene.render_normals = scenehdl::vertex;
+	else if (num == 34)
+	{
+		pick_gpu = false;
+		pick_requested = false;
+		ids.release();
+	}
+	else if (num == 35)
+		pick_gpu = true;
 
 	glutPostRedisplay();
 }
@@ -661,6 +665,11 @@ void object_menu(int num)
 					else
 						i++;
 				}
+
+				for (unsigned int i = 0; i < scene.loading.size(); i++)
+					if (scene.loading[i].placeholder == scene.objects[scene.active_object])
+						scene.loading[i].placeholder = NULL;
+
 				delete scene.objects[scene.active_object];
 			}
 			scene.objects.erase(scene.objects.begin() + scene.active_object);
@@ -740,6 +749,16 @@ void object_menu(int num)
 		}
 		glutPostRedisplay();
 	}
+	else if (num == 11 && scene.active_object_valid())
+	{
+		scene.objects[scene.active_object]->set_format(rigidhdl::float_vertices);
+		glutPostRedisplay();
+	}
+	else if (num == 12 && scene.active_object_valid())
+	{
+		scene.objects[scene.active_object]->set_format(rigidhdl::packed_vertices);
+		glutPostRedisplay();
+	}
 
 }
 
@@ -921,6 +940,12 @@ void create_menu()
 	glutAddMenuEntry(" Face        ", 32);
 	glutAddMenuEntry(" Vertex      ", 33);
 
+	// Contexts older than OpenGL 3 can only pick on the CPU.
+	int picking_id = glutCreateMenu(canvas_menu);
+	glutAddMenuEntry(" Triangles   ", 34);
+	if (idbufferhdl::supported())
+		glutAddMenuEntry(" ID Buffer   ", 35);
+
     canvas_menu_id = glutCreateMenu(canvas_menu);
     glutAddSubMenu  (" Objects     ", objects_id);
     glutAddSubMenu  (" Lights      ", lights_id);
@@ -928,6 +953,7 @@ void create_menu()
     glutAddSubMenu  (" Polygon     ", mode_id);
     glutAddSubMenu  (" Culling     ", culling_id);
     glutAddSubMenu  (" Normals     ", normal_id);
+    glutAddSubMenu  (" Picking     ", picking_id);
     glutAddMenuEntry(" Quit        ", 0);
 
     int material_menu_id = glutCreateMenu(object_menu);
@@ -937,8 +963,13 @@ void create_menu()
     glutAddMenuEntry(" Custom       ", 7);
     glutAddMenuEntry(" Texture     ", 6);
 
+    int vertices_menu_id = glutCreateMenu(object_menu);
+    glutAddMenuEntry(" Float       ", 11);
+    glutAddMenuEntry(" Packed      ", 12);
+
     object_menu_id = glutCreateMenu(object_menu);
     glutAddSubMenu  (" Material    ", material_menu_id);
+    glutAddSubMenu  (" Vertices    ", vertices_menu_id);
     glutAddMenuEntry(" Set Focus   ", 5);
     glutAddMenuEntry(" Translate   ", 1);
     glutAddMenuEntry(" Rotate      ", 2);
@@ -971,6 +1002,9 @@ void create_menu()
 
 int main(int argc, char **argv)
 {
+	if (argc > 1 && string(argv[1]) == "--headless")
+		return headless_main(argc, argv);
+
 	glutInit(&argc, argv);
 	int display_mode = GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE;
 #ifdef OSX_CORE3
@@ -1000,6 +1034,12 @@ int main(int argc, char **argv)
 	cout << "Status: Using OpenGL " << glGetString(GL_VERSION) << endl;
 	cout << "Status: Using GLSL " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 
+	if (!uniform_buffers_supported())
+	{
+		cerr << "Error: The lighting shaders need OpenGL 3.1 or GL_ARB_uniform_buffer_object." << endl;
+		exit(1);
+	}
+
 	working_directory = string(argv[0]).substr(0, string(argv[0]).find_last_of("/\\")) + "/";
 
 	init();
@@ -0,0 +1,132 @@
+/*
+ * mapping.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "mapping.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mappinghdl::mappinghdl()
+{
+	data = NULL;
+	size = 0;
+#ifdef WIN32
+	file = NULL;
+	mapping = NULL;
+#endif
+}
+
+mappinghdl::mappinghdl(string filename)
+{
+	data = NULL;
+	size = 0;
+#ifdef WIN32
+	file = NULL;
+	mapping = NULL;
+#endif
+	open(filename);
+}
+
+mappinghdl::~mappinghdl()
+{
+	close();
+}
+
+/* open
+ *
+ * Map the file located at 'filename' into memory. An empty
+ * file opens successfully with a size of zero and no data.
+ */
+bool mappinghdl::open(string filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(f, &length))
+	{
+		CloseHandle(f);
+		return false;
+	}
+
+	file = f;
+	size = (size_t)length.QuadPart;
+	if (size == 0)
+		return true;
+
+	mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (data == NULL)
+	{
+		close();
+		return false;
+	}
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			::close(fd);
+			size = 0;
+			return false;
+		}
+
+		madvise(ptr, size, MADV_SEQUENTIAL);
+		data = (const char*)ptr;
+	}
+
+	// The mapping keeps its own reference to the file.
+	::close(fd);
+#endif
+
+	return true;
+}
+
+void mappinghdl::close()
+{
+#ifdef WIN32
+	if (data != NULL)
+		UnmapViewOfFile(data);
+	if (mapping != NULL)
+		CloseHandle(mapping);
+	if (file != NULL)
+		CloseHandle(file);
+	mapping = NULL;
+	file = NULL;
+#else
+	if (data != NULL)
+		munmap((void*)data, size);
+#endif
+
+	data = NULL;
+	size = 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * mapping.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "standard.h"
+
+#ifndef mapping_h
+#define mapping_h
+
+/* This is a read-only view of a file on disk. The
+ * file is memory mapped so that parsers can walk it
+ * in place without copying it into a string or stream.
+ */
+struct mappinghdl
+{
+	mappinghdl();
+	mappinghdl(string filename);
+	~mappinghdl();
+
+	const char *data;
+	size_t size;
+
+#ifdef WIN32
+	void *file;
+	void *mapping;
+#endif
+
+	bool open(string filename);
+	void close();
+
+private:
+	mappinghdl(const mappinghdl &m);
+	mappinghdl &operator=(const mappinghdl &m);
+};
+
+#endif
@@ -12,14 +12,17 @@
 GLuint whitehdl::vertex = 0;
 GLuint whitehdl::fragment = 0;
 GLuint whitehdl::program = 0;
+programhdl whitehdl::uniforms;
 
 GLuint gouraudhdl::vertex = 0;
 GLuint gouraudhdl::fragment = 0;
 GLuint gouraudhdl::program = 0;
+programhdl gouraudhdl::uniforms;
 
 GLuint phonghdl::vertex = 0;
 GLuint phonghdl::fragment = 0;
 GLuint phonghdl::program = 0;
+programhdl phonghdl::uniforms;
 
 GLuint customhdl::vertex = 0;
 GLuint customhdl::fragment = 0;
@@ -28,6 +31,7 @@ GLuint customhdl::program = 0;
 GLuint texturehdl::vertex = 0;
 GLuint texturehdl::fragment = 0;
 GLuint texturehdl::program = 0;
+programhdl texturehdl::uniforms;
 GLuint texturehdl::texture = 0;
 
 extern string working_directory;
@@ -41,10 +45,51 @@ materialhdl::~materialhdl()
 {
 }
 
+/* apply
+ *
+ * Make this material current. The render queue calls bind()
+ * and set_uniforms() on their own so that it can skip binding
+ * a program that is already bound.
+ */
+void materialhdl::apply(const vector<lighthdl*> &lights)
+{
+	bind();
+	set_uniforms();
+}
+
+/* program_uniforms
+ *
+ * Get the uniform locations of the program this material
+ * draws with, or NULL if it doesn't use one.
+ */
+const programhdl *materialhdl::program_uniforms() const
+{
+	return NULL;
+}
+
+/* equals
+ *
+ * Check whether drawing with 'm' would look the same as drawing
+ * with this material, so that their geometry can be drawn
+ * together.
+ */
+bool materialhdl::equals(const materialhdl *m) const
+{
+	return m != NULL && type == m->type;
+}
+
 whitehdl::whitehdl()
 {
 	type = "white";
+}
+
+whitehdl::~whitehdl()
+{
 
+}
+
+void whitehdl::bind()
+{
 	if (vertex == 0 && fragment == 0 && program == 0)
 	{
         //load shaders
@@ -52,21 +97,20 @@ whitehdl::whitehdl()
         fragment = load_shader_file(working_directory + "res/white.ft", GL_FRAGMENT_SHADER);
 
         //link shaders
-        program = glCreateProgram();
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
-        glLinkProgram(program);
+        program = link_program(vertex, fragment);
+        uniforms.reflect(program);
 	}
+
+	glUseProgram(program);
 }
 
-whitehdl::~whitehdl()
+void whitehdl::set_uniforms()
 {
-
 }
 
-void whitehdl::apply(const vector<lighthdl*> &lights)
+const programhdl *whitehdl::program_uniforms() const
 {
-	glUseProgram(program);
+	return &uniforms;
 }
 
 materialhdl *whitehdl::clone() const
@@ -84,7 +128,15 @@ gouraudhdl::gouraudhdl()
 	diffuse = vec3f(1.0, 1.0, 1.0);
 	specular = vec3f(1.0, 1.0, 1.0);
 	shininess = 1.0;
+}
 
+gouraudhdl::~gouraudhdl()
+{
+
+}
+
+void gouraudhdl::bind()
+{
 	if (vertex == 0 && fragment == 0 && program == 0)
 	{
         //load shaders
@@ -92,70 +144,34 @@ gouraudhdl::gouraudhdl()
         fragment = load_shader_file(working_directory + "res/gouraud.ft", GL_FRAGMENT_SHADER);
 
         //link shaders
-        program = glCreateProgram();
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
-        glLinkProgram(program);
+        program = link_program(vertex, fragment);
+        uniforms.reflect(program);
 	}
+
+	glUseProgram(program);
 }
 
-gouraudhdl::~gouraudhdl()
+void gouraudhdl::set_uniforms()
 {
-
+	glUniform3f(uniforms.location[uniform_emission], emission[0], emission[1], emission[2]);
+	glUniform3f(uniforms.location[uniform_ambient], ambient[0], ambient[1], ambient[2]);
+	glUniform3f(uniforms.location[uniform_diffuse], diffuse[0], diffuse[1], diffuse[2]);
+	glUniform3f(uniforms.location[uniform_specular], specular[0], specular[1], specular[2]);
+	glUniform1f(uniforms.location[uniform_shininess], shininess);
 }
 
-void gouraudhdl::apply(const vector<lighthdl*> &lights)
+const programhdl *gouraudhdl::program_uniforms() const
 {
-	glUseProgram(program);
-
-	int emission_location = glGetUniformLocation(program, "emission");
-	int ambient_location = glGetUniformLocation(program, "ambient");
-	int diffuse_location = glGetUniformLocation(program, "diffuse");
-	int specular_location = glGetUniformLocation(program, "specular");
-	int shininess_location = glGetUniformLocation(program, "shininess");
-	glUniform3f(emission_location, emission[0], emission[1], emission[2]);
-	glUniform3f(ambient_location, ambient[0], ambient[1], ambient[2]);
-	glUniform3f(diffuse_location, diffuse[0], diffuse[1], diffuse[2]);
-	glUniform3f(specular_location, specular[0], specular[1], specular[2]);
-	glUniform1f(shininess_location, shininess);
-
-    int dlights = 0;
-    int slights = 0;
-    int plights = 0;
-
-    //Send light structs to shader uniforms
-    for (unsigned int i = 0; i < lights.size(); ++i)
-    {
-        std::stringstream name;
-
-        if (lights[i]->type.compare("directional") == 0)
-        {
-            name << "dlights[" << dlights << "].";
-            dlights++;
-        }
-        else if (lights[i]->type.compare("spot") == 0)
-        {
-            name << "slights[" << slights << "].";
-            slights++;
-        }
-        else
-        {
-            name << "plights[" << plights << "].";
-            plights++;
-        }
-
-        lights[i]->apply(name.str(), program);
-    }
+	return &uniforms;
+}
 
-    
-    //Send counts of lights to shader uniforms.
-    GLuint loc = glGetUniformLocation(program, "num_dlights");
-    glUniform1i(loc, dlights);
-    loc = glGetUniformLocation(program, "num_slights");
-    glUniform1i(loc, slights);
-    loc = glGetUniformLocation(program, "num_plights");
-    glUniform1i(loc, plights);
+bool gouraudhdl::equals(const materialhdl *m) const
+{
+	if (!materialhdl::equals(m))
+		return false;
 
+	const gouraudhdl *n = (const gouraudhdl*)m;
+	return emission == n->emission && ambient == n->ambient && diffuse == n->diffuse && specular == n->specular && shininess == n->shininess;
 }
 
 materialhdl *gouraudhdl::clone() const
@@ -178,7 +194,16 @@ phonghdl::phonghdl()
 	diffuse = vec3f(1.0, 1.0, 1.0);
 	specular = vec3f(1.0, 1.0, 1.0);
 	shininess = 1.0;
+}
 
+phonghdl::~phonghdl()
+{
+
+}
+
+void phonghdl::bind()
+{
+	// TODO Assignment 4: Apply the shader program and pass it the necessary uniform values
 	if (vertex == 0 && fragment == 0 && program == 0)
 	{
         std::cout << "loading phong" << std::endl;
@@ -187,71 +212,34 @@ phonghdl::phonghdl()
         fragment = load_shader_file(working_directory + "res/phong.ft", GL_FRAGMENT_SHADER);
 
         //link shaders
-        program = glCreateProgram();
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
-        glLinkProgram(program);
+        program = link_program(vertex, fragment);
+        uniforms.reflect(program);
 	}
 
+	glUseProgram(program);
 }
 
-phonghdl::~phonghdl()
+void phonghdl::set_uniforms()
 {
-
+	glUniform3f(uniforms.location[uniform_emission], emission[0], emission[1], emission[2]);
+	glUniform3f(uniforms.location[uniform_ambient], ambient[0], ambient[1], ambient[2]);
+	glUniform3f(uniforms.location[uniform_diffuse], diffuse[0], diffuse[1], diffuse[2]);
+	glUniform3f(uniforms.location[uniform_specular], specular[0], specular[1], specular[2]);
+	glUniform1f(uniforms.location[uniform_shininess], shininess);
 }
 
-void phonghdl::apply(const vector<lighthdl*> &lights)
+const programhdl *phonghdl::program_uniforms() const
 {
-	// TODO Assignment 4: Apply the shader program and pass it the necessary uniform values
-	glUseProgram(program);
-
-	int emission_location = glGetUniformLocation(program, "emission");
-	int ambient_location = glGetUniformLocation(program, "ambient");
-	int diffuse_location = glGetUniformLocation(program, "diffuse");
-	int specular_location = glGetUniformLocation(program, "specular");
-	int shininess_location = glGetUniformLocation(program, "shininess");
-	glUniform3f(emission_location, emission[0], emission[1], emission[2]);
-	glUniform3f(ambient_location, ambient[0], ambient[1], ambient[2]);
-	glUniform3f(diffuse_location, diffuse[0], diffuse[1], diffuse[2]);
-	glUniform3f(specular_location, specular[0], specular[1], specular[2]);
-	glUniform1f(shininess_location, shininess);
-
-    int dlights = 0;
-    int slights = 0;
-    int plights = 0;
-
-    //Send light structs to shader uniforms
-    for (unsigned int i = 0; i < lights.size(); ++i)
-    {
-        std::stringstream name;
-
-        if (lights[i]->type.compare("directional") == 0)
-        {
-            name << "dlights[" << dlights << "].";
-            dlights++;
-        }
-        else if (lights[i]->type.compare("spot") == 0)
-        {
-            name << "slights[" << slights << "].";
-            slights++;
-        }
-        else
-        {
-            name << "plights[" << plights << "].";
-            plights++;
-        }
+	return &uniforms;
+}
 
-        lights[i]->apply(name.str(), program);
-    }
+bool phonghdl::equals(const materialhdl *m) const
+{
+	if (!materialhdl::equals(m))
+		return false;
 
-    
-    //Send counts of lights to shader uniforms.
-    GLuint loc = glGetUniformLocation(program, "num_dlights");
-    glUniform1i(loc, dlights);
-    loc = glGetUniformLocation(program, "num_slights");
-    glUniform1i(loc, slights);
-    loc = glGetUniformLocation(program, "num_plights");
-    glUniform1i(loc, plights);
+	const phonghdl *n = (const phonghdl*)m;
+	return emission == n->emission && ambient == n->ambient && diffuse == n->diffuse && specular == n->specular && shininess == n->shininess;
 }
 
 materialhdl *phonghdl::clone() const
@@ -285,7 +273,11 @@ customhdl::~customhdl()
 
 }
 
-void customhdl::apply(const vector<lighthdl*> &lights)
+void customhdl::bind()
+{
+}
+
+void customhdl::set_uniforms()
 {
 }
 
@@ -301,9 +293,14 @@ texturehdl::texturehdl()
 	type = "texture";
 
 	shininess = 1.0;
-    
+}
 
+texturehdl::~texturehdl()
+{
+}
 
+void texturehdl::bind()
+{
 	if (vertex == 0 && fragment == 0 && program == 0)
 	{
         glEnable(GL_TEXTURE_2D);
@@ -339,66 +336,34 @@ texturehdl::texturehdl()
         fragment = load_shader_file(working_directory + "res/texture.ft", GL_FRAGMENT_SHADER);
 
         //link shaders
-        program = glCreateProgram();
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
-        glLinkProgram(program);
+        program = link_program(vertex, fragment);
+        uniforms.reflect(program);
 	}
 
-}
-
-texturehdl::~texturehdl()
-{
-}
-
-void texturehdl::apply(const vector<lighthdl*> &lights)
-{
 	glUseProgram(program);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
-    int tex_location = glGetUniformLocation(program, "tex");
-    glUniform1i(tex_location, 0);
-    int shininess_location = glGetUniformLocation(program, "shininess");
-	glUniform1f(shininess_location, shininess);
-
-    int dlights = 0;
-    int slights = 0;
-    int plights = 0;
-
-    //Send light structs to shader uniforms
-    for (unsigned int i = 0; i < lights.size(); ++i)
-    {
-        std::stringstream name;
+    glUniform1i(uniforms.location[uniform_tex], 0);
+}
 
-        if (lights[i]->type.compare("directional") == 0)
-        {
-            name << "dlights[" << dlights << "].";
-            dlights++;
-        }
-        else if (lights[i]->type.compare("spot") == 0)
-        {
-            name << "slights[" << slights << "].";
-            slights++;
-        }
-        else
-        {
-            name << "plights[" << plights << "].";
-            plights++;
-        }
+void texturehdl::set_uniforms()
+{
+	glUniform1f(uniforms.location[uniform_shininess], shininess);
+}
 
-        lights[i]->apply(name.str(), program);
-    }
+const programhdl *texturehdl::program_uniforms() const
+{
+	return &uniforms;
+}
 
-    
-    //Send counts of lights to shader uniforms.
-    GLuint loc = glGetUniformLocation(program, "num_dlights");
-    glUniform1i(loc, dlights);
-    loc = glGetUniformLocation(program, "num_slights");
-    glUniform1i(loc, slights);
-    loc = glGetUniformLocation(program, "num_plights");
-    glUniform1i(loc, plights);
+bool texturehdl::equals(const materialhdl *m) const
+{
+	if (!materialhdl::equals(m))
+		return false;
 
+	const texturehdl *n = (const texturehdl*)m;
+	return shininess == n->shininess;
 }
 
 materialhdl *texturehdl::clone() const
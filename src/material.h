@@ -16,6 +16,10 @@ using namespace core;
 
 struct lighthdl;
 
+/* Materials don't touch OpenGL until they are first applied,
+ * which compiles their shaders. This means they can be created
+ * on any thread, for example by a model loading in the background.
+ */
 struct materialhdl
 {
 	materialhdl();
@@ -23,7 +27,17 @@ struct materialhdl
 
 	string type;
 
-	virtual void apply(const vector<lighthdl*> &lights) = 0;
+	void apply(const vector<lighthdl*> &lights);
+
+	// Load and bind this material's program and textures, which
+	// are shared by every material of the same type.
+	virtual void bind() = 0;
+
+	// Send the uniforms that are particular to this material.
+	virtual void set_uniforms() = 0;
+
+	virtual const programhdl *program_uniforms() const;
+	virtual bool equals(const materialhdl *m) const;
 	virtual materialhdl *clone() const = 0;
 };
 
@@ -35,8 +49,11 @@ struct whitehdl : materialhdl
 	static GLuint vertex;
 	static GLuint fragment;
 	static GLuint program;
+	static programhdl uniforms;
 
-	void apply(const vector<lighthdl*> &lights);
+	void bind();
+	void set_uniforms();
+	const programhdl *program_uniforms() const;
 	materialhdl *clone() const;
 };
 
@@ -54,8 +71,12 @@ struct gouraudhdl : materialhdl
 	static GLuint vertex;
 	static GLuint fragment;
 	static GLuint program;
+	static programhdl uniforms;
 
-	void apply(const vector<lighthdl*> &lights);
+	void bind();
+	void set_uniforms();
+	const programhdl *program_uniforms() const;
+	bool equals(const materialhdl *m) const;
 	materialhdl *clone() const;
 };
 
@@ -73,8 +94,12 @@ struct phonghdl : materialhdl
 	static GLuint vertex;
 	static GLuint fragment;
 	static GLuint program;
+	static programhdl uniforms;
 
-	void apply(const vector<lighthdl*> &lights);
+	void bind();
+	void set_uniforms();
+	const programhdl *program_uniforms() const;
+	bool equals(const materialhdl *m) const;
 	materialhdl *clone() const;
 };
 
@@ -87,7 +112,8 @@ struct customhdl : materialhdl
 	static GLuint fragment;
 	static GLuint program;
 
-	void apply(const vector<lighthdl*> &lights);
+	void bind();
+	void set_uniforms();
 	materialhdl *clone() const;
 };
 
@@ -101,10 +127,14 @@ struct texturehdl : materialhdl
 	static GLuint vertex;
 	static GLuint fragment;
 	static GLuint program;
+	static programhdl uniforms;
 
 	static GLuint texture;
 
-	void apply(const vector<lighthdl*> &lights);
+	void bind();
+	void set_uniforms();
+	const programhdl *program_uniforms() const;
+	bool equals(const materialhdl *m) const;
 	materialhdl *clone() const;
 };
 
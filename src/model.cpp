@@ -7,15 +7,264 @@
 
 #include "model.h"
 #include "standard.h"
+#include "mapping.h"
+#include "tokenizer.h"
+#include "pool.h"
+#include <sys/stat.h>
+
+/* These hold the part of an .obj file between two line
+ * boundaries so that the file can be parsed in pieces on
+ * separate threads. Vertex data is kept in file order and
+ * faces are kept as index triples until the pieces are
+ * merged back together.
+ */
+struct eventhdl
+{
+	enum
+	{
+		touch = 0,
+		group = 1,
+		usemtl = 2,
+		mtllib = 3
+	} type;
+
+	// The number of faces read before this event
+	int face;
+	string name;
+};
+
+/* This is an open addressed hash table that gives each distinct
+ * (v, t, n) index triple a number in order of first appearance.
+ * It never grows, so it has to be given an upper bound on the
+ * number of distinct keys.
+ */
+struct cornermaphdl
+{
+	cornermaphdl(int count)
+	{
+		int size = 16;
+		while (size < 2*count)
+			size <<= 1;
+		slots.resize(size, -1);
+		keys.reserve(count);
+	}
+
+	vector<int> slots;
+	vector<vec3i> keys;
+
+	int insert(const vec3i &key)
+	{
+		unsigned int mask = (unsigned int)slots.size()-1;
+		unsigned int slot = ((unsigned int)key[0]*73856093u ^ (unsigned int)key[1]*19349663u ^ (unsigned int)key[2]*83492791u) & mask;
+		while (slots[slot] >= 0)
+		{
+			const vec3i &other = keys[slots[slot]];
+			if (other[0] == key[0] && other[1] == key[1] && other[2] == key[2])
+				return slots[slot];
+			slot = (slot + 1) & mask;
+		}
+
+		slots[slot] = (int)keys.size();
+		keys.push_back(key);
+		return slots[slot];
+	}
+};
+
+/* A run of faces that all land in the same rigid body. The
+ * distinct corners of the run are numbered locally first, then
+ * 'remap' maps those numbers onto the vertices of the rigid body.
+ */
+struct segmenthdl
+{
+	int rigid;
+	int face_begin;
+	int face_end;
+	int geometry_offset;
+	int index_offset;
+
+	vector<vec3i> keys;
+	vector<int> remap;
+};
+
+struct chunkhdl
+{
+	chunkhdl()
+	{
+		sum = vec3f(0.0, 0.0, 0.0);
+		num = 0;
+		touched = false;
+		corners.push_back(0);
+		triangles.push_back(0);
+	}
+
+	const char *begin;
+	const char *end;
+
+	vector<vec3f> vertices;
+	vector<vec3f> normals;
+	vector<vec2f> texcoords;
+	vec3f sum;
+	float num;
+
+	// (v, t, n) for each face corner, zero based, -1 if missing.
+	vector<vec3i> indices;
+
+	// Running totals of corners and triangles at the start of each face.
+	vector<int> corners;
+	vector<int> triangles;
+
+	// The local vertex number of each face corner within its segment
+	vector<int> local;
+
+	// Corners with an index that is relative to the start of this
+	// chunk's vertex data (given as the element of 'indices' and the
+	// component) rather than to the start of the file.
+	vector<vec2i> relative;
+
+	vector<eventhdl> events;
+	bool touched;
+
+	vector<segmenthdl> segments;
+	vec6f bound;
+
+	void parse();
+};
+
+/* resolve
+ *
+ * Convert a one based .obj index into a zero based index.
+ * Negative indices count back from 'count', the amount of
+ * data this chunk has read so far.
+ */
+static inline int resolve(int index, int count, bool &relative)
+{
+	relative = (index < 0);
+	if (index < 0)
+		return count + index;
+	return index - 1;
+}
+
+void chunkhdl::parse()
+{
+	float x, y, z;
+	int v, n, t;
+	bool rv, rn, rt;
+
+	const char *tbegin, *tend;
+	tokenizerhdl tokens(begin, end);
+	for (; !tokens.done(); tokens.skip_line())
+	{
+		if (!tokens.token(tbegin, tend))
+			continue;
+
+		if (token_equals(tbegin, tend, "v") || token_equals(tbegin, tend, "vn") || token_equals(tbegin, tend, "vt") || token_equals(tbegin, tend, "f"))
+		{
+			if (!touched)
+			{
+				events.push_back(eventhdl());
+				events.back().type = eventhdl::touch;
+				events.back().face = (int)corners.size()-1;
+				touched = true;
+			}
+
+			if (tend - tbegin == 1 && *tbegin == 'v')
+			{
+				if (tokens.read(x) && tokens.read(y) && tokens.read(z))
+				{
+					vertices.push_back(vec3f(x, y, z));
+					sum += vec3f(x, y, z);
+					num += 1.0;
+				}
+			}
+			else if (tbegin[1] == 'n')
+			{
+				if (tokens.read(x) && tokens.read(y) && tokens.read(z))
+					normals.push_back(vec3f(x, y, z));
+			}
+			else if (tbegin[1] == 't')
+			{
+				if (tokens.read(x) && tokens.read(y))
+					texcoords.push_back(vec2f(x, y));
+			}
+			else
+			{
+				int count = 0;
+				while (tokens.token(tbegin, tend))
+				{
+					vec3i corner(-1, -1, -1);
+
+					// v, v/t, v//n or v/t/n
+					if (parse_int(tbegin, tend, v))
+					{
+						t = 0;
+						n = 0;
+						if (tbegin < tend && *tbegin == '/')
+						{
+							tbegin++;
+							if (tbegin < tend && *tbegin == '/')
+							{
+								tbegin++;
+								parse_int(tbegin, tend, n);
+							}
+							else if (parse_int(tbegin, tend, t) && tbegin < tend && *tbegin == '/')
+							{
+								tbegin++;
+								parse_int(tbegin, tend, n);
+							}
+						}
+
+						corner[0] = resolve(v, (int)vertices.size(), rv);
+						corner[1] = resolve(t, (int)texcoords.size(), rt);
+						corner[2] = resolve(n, (int)normals.size(), rn);
+						if (rv)
+							relative.push_back(vec2i((int)indices.size(), 0));
+						if (rt)
+							relative.push_back(vec2i((int)indices.size(), 1));
+						if (rn)
+							relative.push_back(vec2i((int)indices.size(), 2));
+					}
+
+					indices.push_back(corner);
+					count++;
+				}
+
+				corners.push_back(corners.back() + count);
+				triangles.push_back(triangles.back() + max(count-2, 0));
+			}
+		}
+		else if (token_equals(tbegin, tend, "mtllib") || token_equals(tbegin, tend, "usemtl"))
+		{
+			events.push_back(eventhdl());
+			events.back().type = (tbegin[0] == 'm' ? eventhdl::mtllib : eventhdl::usemtl);
+			events.back().face = (int)corners.size()-1;
+			if (tokens.token(tbegin, tend))
+				events.back().name.assign(tbegin, tend);
+			else if (events.back().type == eventhdl::mtllib)
+				events.pop_back();
+			else
+				events.back().type = eventhdl::touch;
+		}
+		else if (token_equals(tbegin, tend, "g"))
+		{
+			events.push_back(eventhdl());
+			events.back().type = eventhdl::group;
+			events.back().face = (int)corners.size()-1;
+		}
+	}
+}
 
 modelhdl::modelhdl()
 {
 
 }
 
-modelhdl::modelhdl(string filename)
+modelhdl::modelhdl(string filename, int threads, float weld_epsilon)
 {
-	load_obj(filename);
+	if (!load_cache(filename + ".cache", weld_epsilon))
+	{
+		load_obj(filename, threads, weld_epsilon);
+		save_cache(filename + ".cache", weld_epsilon);
+	}
 }
 
 modelhdl::~modelhdl()
@@ -39,140 +288,268 @@ modelhdl::~modelhdl()
  * different from the one we are using here. You may change your
  * representation if you like, but just remember to account for this
  * in some way.
+ *
+ * The file is memory mapped and tokenized in place, so parsing
+ * a line never allocates. Large files are split at line boundaries
+ * into one chunk per thread (0 uses every core). Each chunk is parsed
+ * on its own, then the chunks are stitched back together using
+ * prefix sums of their vertex, corner and triangle counts, and the
+ * rigid bodies are filled in parallel. Negative indices count back
+ * from the end of the vertex lists.
+ *
+ * Face corners that use the same (v, vt, vn) triple within a rigid
+ * body share a single vertex. If 'weld_epsilon' is greater than zero,
+ * vertices that are within that distance of each other in every
+ * attribute are merged afterwards as well. Finally, each rigid body
+ * is reordered for the vertex cache and its levels of detail are built.
  */
-void modelhdl::load_obj(string filename)
+void modelhdl::load_obj(string filename, int threads, float weld_epsilon)
 {
-	float x, y, z;
-	int v, n, t;
+	// Files smaller than this aren't worth splitting up
+	const size_t min_chunk_size = 256*1024;
 
-	ifstream fin(filename.c_str());
-	if (!fin.is_open())
+	mappinghdl file;
+	if (!file.open(filename))
 	{
 		cerr << "Error: file not found: " << filename << endl;
 		return;
 	}
+	sources.push_back(filename);
+
+	poolhdl &pool = poolhdl::shared();
+	if (threads <= 0)
+		threads = pool.size();
+
+	int count = (int)max(min((size_t)threads, file.size/min_chunk_size), (size_t)1);
+	vector<chunkhdl> chunks(count);
+	const char *begin = file.data;
+	const char *end = file.data + file.size;
+	for (int i = 0; i < count; i++)
+	{
+		chunks[i].begin = begin;
+		if (i < count-1)
+		{
+			tokenizerhdl split(file.data + file.size*(i+1)/count, end);
+			split.skip_line();
+			begin = max(begin, split.ptr);
+		}
+		else
+			begin = end;
+		chunks[i].end = begin;
+	}
 
+	pool.run(count, [&](int i) {
+		chunks[i].parse();
+	});
+
+	// Prefix sum the vertex data and gather it into one list
 	vector<vec3f> vertices;
 	vector<vec3f> normals;
 	vector<vec2f> texcoords;
 	vec3f ave(0.0, 0.0, 0.0);
 	float num = 0;
-
-	string line(256, '\0');
-	string command;
-	while (getline(fin, line))
+	for (int i = 0; i < count; i++)
 	{
-		istringstream iss(line);
+		vec3i base((int)vertices.size(), (int)texcoords.size(), (int)normals.size());
+		for (unsigned int j = 0; j < chunks[i].relative.size(); j++)
+			chunks[i].indices[chunks[i].relative[j][0]][chunks[i].relative[j][1]] += base[chunks[i].relative[j][1]];
 
-		if (iss >> command)
+		vertices.insert(vertices.end(), chunks[i].vertices.begin(), chunks[i].vertices.end());
+		normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+		ave += chunks[i].sum;
+		num += chunks[i].num;
+	}
+
+	// Replay the grouping commands in order to assign each run of faces
+	// to a rigid body, and place that run's triangles within the rigid body.
+	vector<int> sizes(rigid.size(), 0);
+	vector<vector<segmenthdl*> > runs(rigid.size());
+	for (unsigned int k = 0; k < rigid.size(); k++)
+		sizes[k] = (int)rigid[k].mesh->indices.size();
+
+	for (int i = 0; i < count; i++)
+	{
+		chunkhdl &c = chunks[i];
+		int face = 0;
+		for (unsigned int j = 0; j <= c.events.size(); j++)
 		{
-			if (command == "mtllib")
+			int next = (j < c.events.size() ? c.events[j].face : (int)c.corners.size()-1);
+			if (next > face)
 			{
-				string mtlname;
-				iss >> mtlname;
+				segmenthdl s;
+				s.rigid = (int)rigid.size()-1;
+				s.face_begin = face;
+				s.face_end = next;
+				s.geometry_offset = 0;
+				s.index_offset = sizes[s.rigid];
+				sizes[s.rigid] += 3*(c.triangles[next] - c.triangles[face]);
+				c.segments.push_back(s);
+				face = next;
+			}
 
-				if (mtlname.size() > 0 && mtlname[0] != '/')
+			if (j < c.events.size())
+			{
+				eventhdl &e = c.events[j];
+				if (e.type == eventhdl::group)
 				{
-					unsigned int idx = filename.find_last_of("/");
-					if (idx == string::npos)
-						idx = filename.find_last_of("\\");
-					mtlname = filename.substr(0, idx) + "/" + mtlname;
+					rigid.push_back(rigidhdl());
+					sizes.push_back(0);
+					runs.push_back(vector<segmenthdl*>());
+					if (rigid.size() > 1)
+						rigid[rigid.size()-1].material = rigid[rigid.size()-2].material;
 				}
+				else if (e.type == eventhdl::mtllib)
+				{
+					string mtlname = e.name;
+					if (mtlname[0] != '/')
+					{
+						size_t idx = filename.find_last_of("/\\");
+						if (idx != string::npos)
+							mtlname = filename.substr(0, idx) + "/" + mtlname;
+					}
 
-				load_mtl(mtlname);
-			}
-			else if (command == "g")
-			{
-				rigid.push_back(rigidhdl());
-				if (rigid.size() > 1)
-					rigid[rigid.size()-1].material = rigid[rigid.size()-2].material;
-			}
-			else if (command == "usemtl")
-			{
-				if (rigid.size() == 0)
+					load_mtl(mtlname);
+				}
+				else if (rigid.size() == 0)
+				{
 					rigid.push_back(rigidhdl());
+					sizes.push_back(0);
+					runs.push_back(vector<segmenthdl*>());
+				}
 
-				iss >> rigid.back().material;
+				if (e.type == eventhdl::usemtl)
+					rigid.back().material = e.name;
 			}
-			else if (command == "v" || command == "vn" || command == "vt" || command == "f")
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+		for (unsigned int j = 0; j < chunks[i].segments.size(); j++)
+			runs[chunks[i].segments[j].rigid].push_back(&chunks[i].segments[j]);
+
+	for (unsigned int k = 0; k < rigid.size(); k++)
+		rigid[k].mesh->indices.resize(sizes[k]);
+
+	// Number the distinct (v, t, n) triples within each run of faces
+	pool.run(count, [&](int i) {
+		chunkhdl &c = chunks[i];
+		c.local.resize(c.indices.size());
+		for (unsigned int j = 0; j < c.segments.size(); j++)
+		{
+			segmenthdl &s = c.segments[j];
+			cornermaphdl map(c.corners[s.face_end] - c.corners[s.face_begin]);
+			for (int k = c.corners[s.face_begin]; k < c.corners[s.face_end]; k++)
 			{
-				if (rigid.size() == 0)
-					rigid.push_back(rigidhdl());
+				vec3i key = c.indices[k];
+				if (key[0] < 0 || key[0] >= (int)vertices.size())
+					key[0] = -1;
+				if (key[1] < 0 || key[1] >= (int)texcoords.size())
+					key[1] = -1;
+				if (key[2] < 0 || key[2] >= (int)normals.size())
+					key[2] = -1;
+				c.local[k] = map.insert(key);
+			}
+			s.keys.swap(map.keys);
+		}
+	});
 
-				if (command == "v" && iss >> x >> y >> z)
-				{
-					vertices.push_back(vec3f(x, y, z));
-					ave += vec3f(x, y, z);
-					num += 1.0;
-				}
-				else if (command == "vn" && iss >> x >> y >> z)
-					normals.push_back(vec3f(x, y, z));
-				else if (command == "vt" && iss >> x >> y)
-					texcoords.push_back(vec2f(x, y));
-				else if (command == "f")
-				{
-					int first = rigid.back().geometry.size();
-					string part;
-					int i = 0;
-					while (iss >> part)
-					{
-						vec8f point(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
-						v = -1;
-						n = -1;
-						t = -1;
+	// Merge the numbering of all of the runs in each rigid body. The
+	// vertices that a run adds to its rigid body are numbered
+	// consecutively starting at its geometry_offset.
+	pool.run((int)rigid.size(), [&](int k) {
+		int total = 0;
+		for (unsigned int j = 0; j < runs[k].size(); j++)
+			total += (int)runs[k][j]->keys.size();
 
-						if (sscanf(part.c_str(), "%d/%d/%d", &v, &t, &n) == 3)
-						{
-							point.set(0,3, vertices[v-1]);
-							point.set(6,8, texcoords[t-1]);
-							point.set(3,6, normals[n-1]);
-						}
-						else if (sscanf(part.c_str(), "%d//%d", &v, &n) == 2)
-						{
-							point.set(0,3, vertices[v-1]);
-							point.set(3,6, normals[n-1]);
-						}
-						else if (sscanf(part.c_str(), "%d/%d", &v, &t) == 2)
-						{
-							point.set(0,3, vertices[v-1]);
-							point.set(6,8, texcoords[t-1]);
-						}
-						else if (sscanf(part.c_str(), "%d", &v) == 1)
-							point.set(0,3, vertices[v-1]);
+		int base = (int)rigid[k].mesh->geometry.size();
+		cornermaphdl map(total);
+		for (unsigned int j = 0; j < runs[k].size(); j++)
+		{
+			segmenthdl &s = *runs[k][j];
+			s.geometry_offset = base + (int)map.keys.size();
+			s.remap.resize(s.keys.size());
+			for (unsigned int l = 0; l < s.keys.size(); l++)
+				s.remap[l] = base + map.insert(s.keys[l]);
+		}
 
-						bound[0] = min(bound[0], point[0]);
-						bound[1] = max(bound[1], point[0]);
-						bound[2] = min(bound[2], point[1]);
-						bound[3] = max(bound[3], point[1]);
-						bound[4] = min(bound[4], point[2]);
-						bound[5] = max(bound[5], point[2]);
+		rigid[k].mesh->geometry.resize(base + map.keys.size());
+	});
 
-						rigid.back().geometry.push_back(point);
+	// Fill in the rigid bodies, every run of faces has its own place
+	pool.run(count, [&](int i) {
+		chunkhdl &c = chunks[i];
+		c.bound = vec6f(1.0e6, -1.0e6, 1.0e6, -1.0e6, 1.0e6, -1.0e6);
+		for (unsigned int j = 0; j < c.segments.size(); j++)
+		{
+			segmenthdl &s = c.segments[j];
+			rigidhdl &r = rigid[s.rigid];
+			for (unsigned int l = 0; l < s.keys.size(); l++)
+			{
+				if (s.remap[l] < s.geometry_offset)
+					continue;
 
-						if (i >= 2)
-						{
-							rigid.back().indices.push_back(first);
-							rigid.back().indices.push_back(rigid.back().geometry.size()-1);
-							rigid.back().indices.push_back(rigid.back().geometry.size()-2);
-						}
-						i++;
-					}
+				vec3i key = s.keys[l];
+				vec8f point(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+				if (key[0] >= 0)
+					point.set(0,3, vertices[key[0]]);
+				if (key[1] >= 0)
+					point.set(6,8, texcoords[key[1]]);
+				if (key[2] >= 0)
+					point.set(3,6, normals[key[2]]);
+
+				c.bound[0] = min(c.bound[0], point[0]);
+				c.bound[1] = max(c.bound[1], point[0]);
+				c.bound[2] = min(c.bound[2], point[1]);
+				c.bound[3] = max(c.bound[3], point[1]);
+				c.bound[4] = min(c.bound[4], point[2]);
+				c.bound[5] = max(c.bound[5], point[2]);
+
+				r.mesh->geometry[s.remap[l]] = point;
+			}
+
+			int index_base = s.index_offset - 3*c.triangles[s.face_begin];
+			for (int f = s.face_begin; f < s.face_end; f++)
+			{
+				int first = c.corners[f];
+				int corner = first + 1;
+				for (int k = index_base + 3*c.triangles[f]; k < index_base + 3*c.triangles[f+1]; k += 3, corner++)
+				{
+					r.mesh->indices[k + 0] = s.remap[c.local[first]];
+					r.mesh->indices[k + 1] = s.remap[c.local[corner+1]];
+					r.mesh->indices[k + 2] = s.remap[c.local[corner]];
 				}
 			}
 		}
-	}
+	});
+
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < 6; j += 2)
+		{
+			bound[j] = min(bound[j], chunks[i].bound[j]);
+			bound[j+1] = max(bound[j+1], chunks[i].bound[j+1]);
+		}
 
 	ave /= num;
 
 	for (int i = 0; i < 6; i++)
 		bound[i] -= ave[i/2];
 
-	for (unsigned int k = 0; k < rigid.size(); k++)
-		for (unsigned int i = 0; i < rigid[k].geometry.size(); i++)
+	pool.run((int)rigid.size(), [&](int k) {
+		for (unsigned int i = 0; i < rigid[k].mesh->geometry.size(); i++)
 			for (unsigned int j = 0; j < 3; j++)
-				rigid[k].geometry[i][j] -= ave[j];
+				rigid[k].mesh->geometry[i][j] -= ave[j];
+
+		if (weld_epsilon > 0.0f)
+			rigid[k].mesh->weld(weld_epsilon);
+
+		rigid[k].mesh->optimize();
+		rigid[k].mesh->generate_lods();
 
-	fin.close();
+		// Build this here so that picking doesn't have to the first
+		// time the mouse goes over the model.
+		rigid[k].mesh->update_bvh();
+	});
 }
 
 /* load_mtl
@@ -181,6 +558,8 @@ void modelhdl::load_obj(string filename)
  */
 void modelhdl::load_mtl(string filename)
 {
+	sources.push_back(filename);
+
 	ifstream fin(filename.c_str());
 	if (!fin.is_open())
 	{
@@ -236,3 +615,433 @@ void modelhdl::load_mtl(string filename)
 		}
 	}
 }
+
+/* The binary cache is laid out as follows, all in native byte order:
+ *
+ * header       cachehdl
+ * sources      {u32 length, name, i64 mtime, i64 size} x header.sources
+ * materials    {u32 length, name, u32 length, type, f32 values[13]} x header.materials
+ * rigids       {u32 length, material, u32 vertices, u32 indices, u32 lods, {u32 indices, f32 error} x lods} x header.rigids
+ * blobs        {pad to 16 bytes, vec8f vertices[], pad to 16 bytes, int indices[], {pad to 16 bytes, int indices[]} x lods} x header.rigids
+ *
+ * The material values are emission, ambient, diffuse, specular and
+ * shininess, whichever of those the material type has.
+ */
+struct cachehdl
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int order;
+	float weld_epsilon;
+	unsigned int sources;
+	unsigned int materials;
+	unsigned int rigids;
+	unsigned int reserved;
+	float bound[6];
+};
+
+static const char cache_magic[4] = {'M', 'E', 'S', 'H'};
+static const unsigned int cache_version = 3;
+static const unsigned int cache_order = 0x01020304;
+
+/* stamp
+ *
+ * Get the modification time and size of a file, or -1 for
+ * both if it doesn't exist.
+ */
+static void stamp(string filename, long long &mtime, long long &size)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) == 0)
+	{
+		mtime = (long long)info.st_mtime;
+		size = (long long)info.st_size;
+	}
+	else
+	{
+		mtime = -1;
+		size = -1;
+	}
+}
+
+/* This reads from a mapped cache file, checking every
+ * read against the end of the file.
+ */
+struct cachereaderhdl
+{
+	cachereaderhdl(const char *begin, const char *end)
+	{
+		this->begin = begin;
+		this->ptr = begin;
+		this->end = end;
+	}
+
+	const char *begin;
+	const char *ptr;
+	const char *end;
+
+	bool read(void *data, size_t size)
+	{
+		if ((size_t)(end - ptr) < size)
+			return false;
+		memcpy(data, ptr, size);
+		ptr += size;
+		return true;
+	}
+
+	bool read(string &str)
+	{
+		unsigned int length;
+		if (!read(&length, sizeof(length)) || (size_t)(end - ptr) < length)
+			return false;
+		str.assign(ptr, length);
+		ptr += length;
+		return true;
+	}
+
+	// Check that 'count' items of 'size' bytes could still be in the
+	// file, so that a corrupt count never reaches resize().
+	bool fits(long long count, size_t size)
+	{
+		return count >= 0 && (size_t)count <= (size_t)(end - ptr)/size;
+	}
+
+	bool skip(size_t size)
+	{
+		if ((size_t)(end - ptr) < size)
+			return false;
+		ptr += size;
+		return true;
+	}
+
+	bool align()
+	{
+		size_t offset = ((ptr - begin) + 15) & ~(size_t)15;
+		if ((size_t)(end - begin) < offset)
+			return false;
+		ptr = begin + offset;
+		return true;
+	}
+};
+
+static void write_string(ostream &fout, const string &str)
+{
+	unsigned int length = (unsigned int)str.size();
+	fout.write((const char*)&length, sizeof(length));
+	fout.write(str.data(), length);
+}
+
+static void write_align(ostream &fout)
+{
+	static const char zeros[16] = {0};
+	size_t offset = (size_t)fout.tellp();
+	fout.write(zeros, ((offset + 15) & ~(size_t)15) - offset);
+}
+
+/* mesh_key
+ *
+ * Get the key that the meshes of the model in the binary cache at
+ * 'filename' are shared under. The cache is rewritten whenever its
+ * sources change, so its own size and modification time tell the
+ * versions of a model apart.
+ */
+static string mesh_key(string filename, float weld_epsilon)
+{
+	long long mtime, size;
+	stamp(filename, mtime, size);
+
+	ostringstream result;
+	result << filename << " " << mtime << " " << size << " " << weld_epsilon;
+	return result.str();
+}
+
+/* load_cache
+ *
+ * Load the binary cache located at 'filename'. This fails if the
+ * cache is missing, was written by a different version or with a
+ * different weld_epsilon, or if any of the .obj or .mtl files it was
+ * built from have changed since, or if any of its counts run past the
+ * end of the file. Meshes that another model already loaded from the
+ * same cache are shared rather than read again. The rest are copied
+ * out of the mapped file into their own vectors.
+ */
+bool modelhdl::load_cache(string filename, float weld_epsilon)
+{
+	mappinghdl file;
+	if (!file.open(filename))
+		return false;
+
+	cachereaderhdl cache(file.data, file.data + file.size);
+
+	cachehdl header;
+	if (!cache.read(&header, sizeof(header)) ||
+		memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+		header.version != cache_version ||
+		header.order != cache_order ||
+		header.weld_epsilon != weld_epsilon ||
+		!cache.fits(header.sources, sizeof(unsigned int) + 2*sizeof(long long)))
+		return false;
+
+	vector<string> files(header.sources);
+	for (unsigned int i = 0; i < header.sources; i++)
+	{
+		long long mtime, size, current_mtime, current_size;
+		if (!cache.read(files[i]) || !cache.read(&mtime, sizeof(mtime)) || !cache.read(&size, sizeof(size)))
+			return false;
+
+		stamp(files[i], current_mtime, current_size);
+		if (mtime != current_mtime || size != current_size)
+			return false;
+	}
+
+	map<string, materialhdl*> materials;
+	bool valid = true;
+	for (unsigned int i = 0; i < header.materials && valid; i++)
+	{
+		string name, type;
+		float values[13];
+		valid = cache.read(name) && cache.read(type) && cache.read(values, sizeof(values));
+		if (!valid)
+			break;
+
+		materialhdl *result = NULL;
+		if (type == "white")
+			result = new whitehdl();
+		else if (type == "gouraud")
+		{
+			gouraudhdl *m = new gouraudhdl();
+			m->emission = vec3f(values[0], values[1], values[2]);
+			m->ambient = vec3f(values[3], values[4], values[5]);
+			m->diffuse = vec3f(values[6], values[7], values[8]);
+			m->specular = vec3f(values[9], values[10], values[11]);
+			m->shininess = values[12];
+			result = m;
+		}
+		else if (type == "phong")
+		{
+			phonghdl *m = new phonghdl();
+			m->emission = vec3f(values[0], values[1], values[2]);
+			m->ambient = vec3f(values[3], values[4], values[5]);
+			m->diffuse = vec3f(values[6], values[7], values[8]);
+			m->specular = vec3f(values[9], values[10], values[11]);
+			m->shininess = values[12];
+			result = m;
+		}
+		else if (type == "custom")
+			result = new customhdl();
+		else if (type == "texture")
+		{
+			texturehdl *m = new texturehdl();
+			m->shininess = values[12];
+			result = m;
+		}
+
+		if (materials.find(name) != materials.end())
+			delete materials[name];
+		materials[name] = result;
+	}
+
+	valid = valid && cache.fits(header.rigids, 4*sizeof(unsigned int));
+	vector<rigidhdl> rigids(valid ? header.rigids : 0);
+	vector<vec3i> sizes(rigids.size());
+	vector<vector<int> > lod_sizes(rigids.size());
+	for (unsigned int i = 0; i < rigids.size() && valid; i++)
+	{
+		valid = cache.read(rigids[i].material) && cache.read(&sizes[i][0], sizeof(int)) && cache.read(&sizes[i][1], sizeof(int)) && cache.read(&sizes[i][2], sizeof(int)) &&
+				cache.fits(sizes[i][0], sizeof(vec8f)) && cache.fits(sizes[i][1], sizeof(int)) && cache.fits(sizes[i][2], 2*sizeof(int));
+		if (valid)
+		{
+			lod_sizes[i].resize(sizes[i][2]);
+			rigids[i].mesh->lod_error.resize(sizes[i][2]);
+		}
+		for (int j = 0; j < sizes[i][2] && valid; j++)
+			valid = cache.read(&lod_sizes[i][j], sizeof(int)) && cache.read(&rigids[i].mesh->lod_error[j], sizeof(float)) &&
+					cache.fits(lod_sizes[i][j], sizeof(int));
+	}
+
+	string key = mesh_key(filename, weld_epsilon);
+	vector<int> loaded;
+	for (unsigned int i = 0; i < rigids.size() && valid; i++)
+	{
+		ostringstream name;
+		name << key << " " << i;
+		shared_ptr<meshhdl> shared = meshhdl::find(name.str());
+		if (shared != NULL)
+		{
+			rigids[i].mesh = shared;
+			valid = cache.align() && cache.skip(sizes[i][0]*sizeof(vec8f)) &&
+					cache.align() && cache.skip(sizes[i][1]*sizeof(int));
+			for (unsigned int j = 0; j < lod_sizes[i].size() && valid; j++)
+				valid = cache.align() && cache.skip(lod_sizes[i][j]*sizeof(int));
+			continue;
+		}
+
+		rigids[i].mesh->geometry.resize(sizes[i][0]);
+		rigids[i].mesh->indices.resize(sizes[i][1]);
+		valid = cache.align() && cache.read(rigids[i].mesh->geometry.data(), sizes[i][0]*sizeof(vec8f)) &&
+				cache.align() && cache.read(rigids[i].mesh->indices.data(), sizes[i][1]*sizeof(int));
+
+		rigids[i].mesh->lods.resize(lod_sizes[i].size());
+		for (unsigned int j = 0; j < lod_sizes[i].size() && valid; j++)
+		{
+			rigids[i].mesh->lods[j].resize(lod_sizes[i][j]);
+			valid = cache.align() && cache.read(rigids[i].mesh->lods[j].data(), lod_sizes[i][j]*sizeof(int));
+		}
+		loaded.push_back(i);
+	}
+
+	if (!valid)
+	{
+		for (map<string, materialhdl*>::iterator i = materials.begin(); i != materials.end(); i++)
+			if (i->second != NULL)
+				delete i->second;
+		return false;
+	}
+
+	// Build these before the meshes are shared, for the same reason
+	// as in load_obj(). Meshes that were already shared have theirs.
+	poolhdl::shared().run((int)loaded.size(), [&](int i) {
+		rigids[loaded[i]].mesh->update_bvh();
+	});
+
+	for (unsigned int i = 0; i < rigids.size(); i++)
+	{
+		ostringstream name;
+		name << key << " " << i;
+		rigids[i].mesh = meshhdl::share(name.str(), rigids[i].mesh);
+	}
+
+	rigid.swap(rigids);
+	for (map<string, materialhdl*>::iterator i = materials.begin(); i != materials.end(); i++)
+	{
+		if (material.find(i->first) != material.end() && material[i->first] != NULL)
+			delete material[i->first];
+		material[i->first] = i->second;
+	}
+	for (int i = 0; i < 6; i++)
+		bound[i] = header.bound[i];
+	sources = files;
+
+	return true;
+}
+
+/* save_cache
+ *
+ * Write this model out to a binary cache at 'filename'. The cache is
+ * written to a temporary file first and then moved into place so that
+ * a partially written cache is never read.
+ */
+void modelhdl::save_cache(string filename, float weld_epsilon)
+{
+	if (sources.size() == 0)
+		return;
+
+	string temporary = filename + ".tmp";
+	ofstream fout(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!fout.is_open())
+		return;
+
+	cachehdl header;
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	header.order = cache_order;
+	header.weld_epsilon = weld_epsilon;
+	header.sources = (unsigned int)sources.size();
+	header.materials = (unsigned int)material.size();
+	header.rigids = (unsigned int)rigid.size();
+	header.reserved = 0;
+	for (int i = 0; i < 6; i++)
+		header.bound[i] = bound[i];
+	fout.write((const char*)&header, sizeof(header));
+
+	for (unsigned int i = 0; i < sources.size(); i++)
+	{
+		long long mtime, size;
+		stamp(sources[i], mtime, size);
+		write_string(fout, sources[i]);
+		fout.write((const char*)&mtime, sizeof(mtime));
+		fout.write((const char*)&size, sizeof(size));
+	}
+
+	for (map<string, materialhdl*>::iterator i = material.begin(); i != material.end(); i++)
+	{
+		float values[13];
+		for (int j = 0; j < 13; j++)
+			values[j] = 0.0f;
+
+		string type = (i->second != NULL ? i->second->type : "");
+		if (type == "gouraud" || type == "phong")
+		{
+			vec3f emission = (type == "gouraud" ? ((gouraudhdl*)i->second)->emission : ((phonghdl*)i->second)->emission);
+			vec3f ambient = (type == "gouraud" ? ((gouraudhdl*)i->second)->ambient : ((phonghdl*)i->second)->ambient);
+			vec3f diffuse = (type == "gouraud" ? ((gouraudhdl*)i->second)->diffuse : ((phonghdl*)i->second)->diffuse);
+			vec3f specular = (type == "gouraud" ? ((gouraudhdl*)i->second)->specular : ((phonghdl*)i->second)->specular);
+			for (int j = 0; j < 3; j++)
+			{
+				values[0 + j] = emission[j];
+				values[3 + j] = ambient[j];
+				values[6 + j] = diffuse[j];
+				values[9 + j] = specular[j];
+			}
+			values[12] = (type == "gouraud" ? ((gouraudhdl*)i->second)->shininess : ((phonghdl*)i->second)->shininess);
+		}
+		else if (type == "texture")
+			values[12] = ((texturehdl*)i->second)->shininess;
+
+		write_string(fout, i->first);
+		write_string(fout, type);
+		fout.write((const char*)values, sizeof(values));
+	}
+
+	for (unsigned int i = 0; i < rigid.size(); i++)
+	{
+		int vertices = (int)rigid[i].mesh->geometry.size();
+		int indices = (int)rigid[i].mesh->indices.size();
+		int lods = (int)rigid[i].mesh->lods.size();
+		write_string(fout, rigid[i].material);
+		fout.write((const char*)&vertices, sizeof(vertices));
+		fout.write((const char*)&indices, sizeof(indices));
+		fout.write((const char*)&lods, sizeof(lods));
+		for (int j = 0; j < lods; j++)
+		{
+			int lod_indices = (int)rigid[i].mesh->lods[j].size();
+			fout.write((const char*)&lod_indices, sizeof(lod_indices));
+			fout.write((const char*)&rigid[i].mesh->lod_error[j], sizeof(float));
+		}
+	}
+
+	for (unsigned int i = 0; i < rigid.size(); i++)
+	{
+		write_align(fout);
+		fout.write((const char*)rigid[i].mesh->geometry.data(), rigid[i].mesh->geometry.size()*sizeof(vec8f));
+		write_align(fout);
+		fout.write((const char*)rigid[i].mesh->indices.data(), rigid[i].mesh->indices.size()*sizeof(int));
+		for (unsigned int j = 0; j < rigid[i].mesh->lods.size(); j++)
+		{
+			write_align(fout);
+			fout.write((const char*)rigid[i].mesh->lods[j].data(), rigid[i].mesh->lods[j].size()*sizeof(int));
+		}
+	}
+
+	bool good = fout.good();
+	fout.close();
+
+#ifdef WIN32
+	if (good)
+		remove(filename.c_str());
+#endif
+	if (!good || rename(temporary.c_str(), filename.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return;
+	}
+
+	// Share the meshes with any model that loads this cache later.
+	string key = mesh_key(filename, weld_epsilon);
+	for (unsigned int i = 0; i < rigid.size(); i++)
+	{
+		ostringstream name;
+		name << key << " " << i;
+		rigid[i].mesh = meshhdl::share(name.str(), rigid[i].mesh);
+	}
+}
@@ -15,11 +15,17 @@
 struct modelhdl : objecthdl
 {
 	modelhdl();
-	modelhdl(string filename);
+	modelhdl(string filename, int threads = 0, float weld_epsilon = 0.0);
 	~modelhdl();
 
-	void load_obj(string filename);
+	// The .obj and .mtl files this model was loaded from
+	vector<string> sources;
+
+	void load_obj(string filename, int threads = 0, float weld_epsilon = 0.0);
 	void load_mtl(string filename);
+
+	bool load_cache(string filename, float weld_epsilon = 0.0);
+	void save_cache(string filename, float weld_epsilon = 0.0);
 };
 
 #endif
@@ -6,10 +6,283 @@
  */
 
 #include "object.h"
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
 
-rigidhdl::rigidhdl()
+// Every mesh that has been shared, by the source file or the
+// primitive parameters that it was made from.
+static map<string, weak_ptr<meshhdl> > mesh_cache;
+static mutex mesh_cache_lock;
+
+// The material that bounding boxes and normals are drawn with.
+static whitehdl line_material;
+
+// The edges of the unit cube, see objecthdl::draw_bound().
+static GLuint bound_buffer = 0;
+
+meshhdl::meshhdl()
+{
+	position_scale = vec3f(1.0, 1.0, 1.0);
+	position_offset = vec3f(0.0, 0.0, 0.0);
+	texcoord_scale = vec2f(1.0, 1.0);
+	texcoord_offset = vec2f(0.0, 0.0);
+	vertex_array = 0;
+	vertex_buffer = 0;
+	index_buffer = 0;
+	uploaded_format = rigidhdl::float_vertices;
+	dirty = true;
+	fingerprint = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		normal_buffer[i] = 0;
+		normal_count[i] = 0;
+		normal_length[i] = 0.0f;
+		normal_fingerprint[i] = 0;
+	}
+}
+
+/* The GPU buffers and the place in the mesh cache belong to one
+ * mesh and aren't copied, the copy makes its own buffers on its
+ * first draw.
+ */
+meshhdl::meshhdl(const meshhdl &m)
+{
+	vertex_array = 0;
+	vertex_buffer = 0;
+	index_buffer = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		normal_buffer[i] = 0;
+		normal_count[i] = 0;
+		normal_length[i] = 0.0f;
+		normal_fingerprint[i] = 0;
+	}
+	*this = m;
+}
+
+meshhdl::~meshhdl()
+{
+	release();
+
+	if (key.size() > 0)
+	{
+		lock_guard<mutex> guard(mesh_cache_lock);
+		map<string, weak_ptr<meshhdl> >::iterator i = mesh_cache.find(key);
+		if (i != mesh_cache.end() && i->second.expired())
+			mesh_cache.erase(i);
+	}
+}
+
+meshhdl &meshhdl::operator=(const meshhdl &m)
+{
+	if (this == &m)
+		return *this;
+
+	release();
+
+	geometry = m.geometry;
+	indices = m.indices;
+	lods = m.lods;
+	lod_error = m.lod_error;
+	packed = m.packed;
+	position_scale = m.position_scale;
+	position_offset = m.position_offset;
+	texcoord_scale = m.texcoord_scale;
+	texcoord_offset = m.texcoord_offset;
+	uploaded_format = m.uploaded_format;
+	dirty = true;
+	fingerprint = m.fingerprint;
+	bvh = m.bvh;
+	return *this;
+}
+
+/* find
+ *
+ * Look up the mesh filed under 'key' in the mesh cache. This
+ * returns NULL if there isn't one or if nothing uses it anymore.
+ */
+shared_ptr<meshhdl> meshhdl::find(string key)
 {
+	lock_guard<mutex> guard(mesh_cache_lock);
+	map<string, weak_ptr<meshhdl> >::iterator i = mesh_cache.find(key);
+	if (i == mesh_cache.end())
+		return shared_ptr<meshhdl>();
+	return i->second.lock();
+}
+
+/* share
+ *
+ * File 'mesh' under 'key' in the mesh cache, after which it must not
+ * change. If another thread got there first, its mesh is returned
+ * instead and 'mesh' should be dropped. The cache only holds weak
+ * pointers, so a mesh leaves it once the last rigid body using it
+ * is gone.
+ */
+shared_ptr<meshhdl> meshhdl::share(string key, shared_ptr<meshhdl> mesh)
+{
+	lock_guard<mutex> guard(mesh_cache_lock);
+	weak_ptr<meshhdl> &entry = mesh_cache[key];
+	shared_ptr<meshhdl> result = entry.lock();
+	if (result == NULL)
+	{
+		mesh->key = key;
+		entry = mesh;
+		result = mesh;
+	}
+	return result;
+}
+
+/* upload
+ *
+ * Copy the vertices in 'vertex_format' and the indices of every
+ * level into GPU buffers, creating them the first time, and record
+ * where each attribute lives in the vertex array object.
+ */
+void meshhdl::upload(int vertex_format)
+{
+	if (vertex_array == 0)
+	{
+		glGenVertexArrays(1, &vertex_array);
+		glGenBuffers(1, &vertex_buffer);
+		glGenBuffers(1, &index_buffer);
+	}
 
+	glBindVertexArray(vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	if (vertex_format == rigidhdl::packed_vertices)
+	{
+		glBufferData(GL_ARRAY_BUFFER, packed.size()*sizeof(packedhdl), packed.data(), GL_STATIC_DRAW);
+		glVertexPointer(3, GL_SHORT, sizeof(packedhdl), (void*)offsetof(packedhdl, position));
+		glNormalPointer(GL_SHORT, sizeof(packedhdl), (void*)offsetof(packedhdl, normal));
+		glTexCoordPointer(2, GL_SHORT, sizeof(packedhdl), (void*)offsetof(packedhdl, texcoord));
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, geometry.size()*sizeof(vec8f), geometry.data(), GL_STATIC_DRAW);
+		glVertexPointer(3, GL_FLOAT, sizeof(float)*8, (void*)0);
+		glNormalPointer(GL_FLOAT, sizeof(float)*8, (void*)(sizeof(float)*3));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(float)*8, (void*)(sizeof(float)*6));
+	}
+
+	// Every level goes in one index buffer, one after the other.
+	level_offset.resize(lods.size()+2);
+	level_offset[0] = 0;
+	level_offset[1] = (int)indices.size();
+	for (unsigned int i = 0; i < lods.size(); i++)
+		level_offset[i+2] = level_offset[i+1] + (int)lods[i].size();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, level_offset.back()*sizeof(int), NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size()*sizeof(int), indices.data());
+	for (unsigned int i = 0; i < lods.size(); i++)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, level_offset[i+1]*sizeof(int), lods[i].size()*sizeof(int), lods[i].data());
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	uploaded_format = vertex_format;
+	dirty = false;
+}
+
+/* release
+ *
+ * Delete the GPU buffers, including the normal lines. This needs
+ * the OpenGL context, but a mesh that has never been drawn has
+ * nothing to delete.
+ */
+void meshhdl::release()
+{
+	if (vertex_array != 0)
+	{
+		glDeleteVertexArrays(1, &vertex_array);
+		glDeleteBuffers(1, &vertex_buffer);
+		glDeleteBuffers(1, &index_buffer);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (normal_buffer[i] != 0)
+			glDeleteBuffers(1, &normal_buffer[i]);
+		normal_buffer[i] = 0;
+		normal_count[i] = 0;
+		normal_length[i] = 0.0f;
+		normal_fingerprint[i] = 0;
+	}
+
+	vertex_array = 0;
+	vertex_buffer = 0;
+	index_buffer = 0;
+	dirty = true;
+}
+
+/* draw_normals
+ *
+ * Draw a line 'length' long along the normal of every vertex, or of
+ * every triangle if 'face' is true. The lines are kept on the GPU
+ * and only made again once the mesh or the length changes.
+ */
+void meshhdl::draw_normals(bool face, float length)
+{
+	int type = (face ? 1 : 0);
+	bool created = false;
+	if (normal_buffer[type] == 0)
+	{
+		glGenBuffers(1, &normal_buffer[type]);
+		created = true;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, normal_buffer[type]);
+	if (created || normal_length[type] != length || normal_fingerprint[type] != hash())
+	{
+		vector<vec3f> lines;
+		if (!face)
+		{
+			lines.reserve(2*geometry.size());
+			for (unsigned int i = 0; i < geometry.size(); i++)
+			{
+				lines.push_back((vec3f)geometry[i](0,3));
+				lines.push_back((vec3f)(geometry[i](0,3) + length*geometry[i](3,6)));
+			}
+		}
+		else
+		{
+			lines.reserve(2*(indices.size()/3));
+			for (unsigned int i = 0; i+2 < indices.size(); i+=3)
+			{
+				vec3f normal = norm((vec3f)geometry[indices[i + 0]](3,6) +
+									(vec3f)geometry[indices[i + 1]](3,6) +
+									(vec3f)geometry[indices[i + 2]](3,6));
+				vec3f center = ((vec3f)geometry[indices[i + 0]](0,3) +
+								(vec3f)geometry[indices[i + 1]](0,3) +
+								(vec3f)geometry[indices[i + 2]](0,3))/3.0f;
+				lines.push_back(center);
+				lines.push_back(center + length*normal);
+			}
+		}
+
+		glBufferData(GL_ARRAY_BUFFER, lines.size()*sizeof(vec3f), lines.data(), GL_STATIC_DRAW);
+		normal_count[type] = (int)lines.size();
+		normal_length[type] = length;
+		normal_fingerprint[type] = hash();
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(vec3f), (void*)0);
+	glDrawArrays(GL_LINES, 0, normal_count[type]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+rigidhdl::rigidhdl()
+{
+	mesh = make_shared<meshhdl>();
+	lod = 0;
+	format = float_vertices;
 }
 
 rigidhdl::~rigidhdl()
@@ -17,40 +290,930 @@ rigidhdl::~rigidhdl()
 
 }
 
+/* edit
+ *
+ * Get this rigid body's mesh in order to change it. A mesh that
+ * another rigid body or the mesh cache could hand out is copied
+ * first, so nothing else sees the change.
+ */
+meshhdl &rigidhdl::edit()
+{
+	if (mesh.use_count() > 1 || mesh->key.size() > 0)
+		mesh = make_shared<meshhdl>(*mesh);
+
+	mesh->packed.clear();
+	mesh->dirty = true;
+	mesh->fingerprint = 0;
+	return *mesh;
+}
+
 /* draw
  *
- * Draw a rigid body.
+ * Draw the selected level of detail with the given program. If
+ * 'instances' is more than zero, the program must be one of ours,
+ * and that many copies are drawn. Each one takes its modelview
+ * matrix from 'instance_buffer', starting at 'offset' bytes, as
+ * four columns of four floats.
  */
-void rigidhdl::draw()
+void rigidhdl::draw(const programhdl *uniforms, int instances, GLuint instance_buffer, size_t offset)
 {
     // Set working texture
     glEnable(GL_TEXTURE_2D);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_NORMAL_ARRAY);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glVertexPointer(3, GL_FLOAT, sizeof(float)*8, (float*)geometry.data());
-	glNormalPointer(GL_FLOAT, sizeof(float)*8, (float*)geometry.data()+3);
-	glTexCoordPointer(2, GL_FLOAT, sizeof(float)*8, (float*)geometry.data()+6);
-	glDrawElements(GL_TRIANGLES, (int)indices.size(), GL_UNSIGNED_INT, indices.data());
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	// The vertex shaders decode packed vertices when told to
+	// by the program's uniforms. Without a program, the fixed
+	// function pipeline can only draw floats.
+	bool decode = (format == packed_vertices && uniforms != NULL && uniforms->program != 0);
+
+	if (decode)
+	{
+		if (mesh->packed.size() != mesh->geometry.size())
+			mesh->pack();
+
+		glUniform1i(uniforms->location[uniform_packed_vertices], 1);
+		glUniform3f(uniforms->location[uniform_position_scale], mesh->position_scale[0], mesh->position_scale[1], mesh->position_scale[2]);
+		glUniform3f(uniforms->location[uniform_position_offset], mesh->position_offset[0], mesh->position_offset[1], mesh->position_offset[2]);
+		glUniform2f(uniforms->location[uniform_texcoord_scale], mesh->texcoord_scale[0], mesh->texcoord_scale[1]);
+		glUniform2f(uniforms->location[uniform_texcoord_offset], mesh->texcoord_offset[0], mesh->texcoord_offset[1]);
+	}
+
+	int vertex_format = (decode ? packed_vertices : float_vertices);
+	if (mesh->dirty || mesh->vertex_array == 0 || mesh->uploaded_format != vertex_format)
+		mesh->upload(vertex_format);
+
+	int level = (lod > 0 && lod <= (int)mesh->lods.size() ? lod : 0);
+	int count = mesh->level_offset[level+1] - mesh->level_offset[level];
+	glBindVertexArray(mesh->vertex_array);
+	if (instances > 0)
+	{
+		glUniform1i(uniforms->location[uniform_instanced], 1);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		for (GLuint i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(instance_attribute + i);
+			glVertexAttribPointer(instance_attribute + i, 4, GL_FLOAT, GL_FALSE, sizeof(float)*16, (void*)(offset + sizeof(float)*4*i));
+			glVertexAttribDivisor(instance_attribute + i, 1);
+		}
+
+		glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void*)(mesh->level_offset[level]*sizeof(int)), instances);
+
+		for (GLuint i = 0; i < 4; i++)
+		{
+			glVertexAttribDivisor(instance_attribute + i, 0);
+			glDisableVertexAttribArray(instance_attribute + i);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glUniform1i(uniforms->location[uniform_instanced], 0);
+	}
+	else
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void*)(mesh->level_offset[level]*sizeof(int)));
+	glBindVertexArray(0);
+
+	// Other geometry drawn with this program is made of floats.
+	if (decode)
+		glUniform1i(uniforms->location[uniform_packed_vertices], 0);
+}
+
+/* hash
+ *
+ * Get a hash of the vertices and of the indices of every level,
+ * which identical rigid bodies share. This is cached in
+ * 'fingerprint'.
+ */
+unsigned long long meshhdl::hash()
+{
+	if (fingerprint == 0)
+	{
+		// FNV-1a
+		unsigned long long result = 14695981039346656037ull;
+		const unsigned char *data = (const unsigned char*)geometry.data();
+		for (size_t i = 0; i < geometry.size()*sizeof(vec8f); i++)
+			result = (result ^ data[i])*1099511628211ull;
+
+		for (int l = 0; l <= (int)lods.size(); l++)
+		{
+			const vector<int> &level = (l == 0 ? indices : lods[l-1]);
+			data = (const unsigned char*)level.data();
+			for (size_t i = 0; i < level.size()*sizeof(int); i++)
+				result = (result ^ data[i])*1099511628211ull;
+
+			// Separate the levels so that moving an index from the
+			// end of one level to the start of the next changes it.
+			result = (result ^ level.size())*1099511628211ull;
+		}
+
+		fingerprint = (result == 0 ? 1 : result);
+	}
+
+	return fingerprint;
+}
+
+/* update_bvh
+ *
+ * Build the bounding volume hierarchy over the full detail triangles
+ * unless it is already up to date with the mesh. This isn't safe to
+ * call from more than one thread at a time.
+ */
+void meshhdl::update_bvh()
+{
+	if (bvh.fingerprint == hash())
+		return;
+
+	vector<vec6f> bounds(indices.size()/3);
+	for (unsigned int i = 0; i < bounds.size(); i++)
+	{
+		vec6f &b = bounds[i];
+		b = vec6f(1.0e30, -1.0e30, 1.0e30, -1.0e30, 1.0e30, -1.0e30);
+		for (int j = 0; j < 3; j++)
+		{
+			const vec8f &v = geometry[indices[i*3 + j]];
+			for (int k = 0; k < 3; k++)
+			{
+				b[2*k] = min(b[2*k], v[k]);
+				b[2*k+1] = max(b[2*k+1], v[k]);
+			}
+		}
+	}
+
+	bvh.build(bounds);
+	bvh.fingerprint = hash();
+}
+
+/* quantize
+ *
+ * Map 'value' from [offset - scale*32767, offset + scale*32767]
+ * onto the nearest 16 bit integer.
+ */
+static short quantize(float value, float scale, float offset)
+{
+	float q = floor((value - offset)/scale + 0.5f);
+	return (short)(q < -32767.0f ? -32767.0f : (q > 32767.0f ? 32767.0f : q));
+}
+
+/* encode_normal
+ *
+ * Project a unit vector onto the octahedron |x| + |y| + |z| = 1 and
+ * unfold the lower half over the upper half, giving two values in
+ * [-1, 1]. Of the four ways to round those to 16 bits, keep the one
+ * that decodes closest to the original vector.
+ */
+static void encode_normal(vec3f n, short *result)
+{
+	float length = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+	if (length == 0.0f)
+	{
+		result[0] = result[1] = result[2] = 0;
+		return;
+	}
+
+	float x = n[0]/length, y = n[1]/length;
+	if (n[2] < 0.0f)
+	{
+		float ox = (1.0f - fabs(y))*(x >= 0.0f ? 1.0f : -1.0f);
+		float oy = (1.0f - fabs(x))*(y >= 0.0f ? 1.0f : -1.0f);
+		x = ox;
+		y = oy;
+	}
+
+	float best = -2.0f;
+	for (int i = 0; i < 4; i++)
+	{
+		float qx = (i & 1) ? ceil(x*32767.0f) : floor(x*32767.0f);
+		float qy = (i & 2) ? ceil(y*32767.0f) : floor(y*32767.0f);
+		qx = min(max(qx, -32767.0f), 32767.0f);
+		qy = min(max(qy, -32767.0f), 32767.0f);
+
+		vec3f d(qx/32767.0f, qy/32767.0f, 0.0f);
+		d[2] = 1.0f - fabs(d[0]) - fabs(d[1]);
+		if (d[2] < 0.0f)
+		{
+			float dx = (1.0f - fabs(d[1]))*(d[0] >= 0.0f ? 1.0f : -1.0f);
+			float dy = (1.0f - fabs(d[0]))*(d[1] >= 0.0f ? 1.0f : -1.0f);
+			d[0] = dx;
+			d[1] = dy;
+		}
+
+		float similarity = dot(norm(d), n)/mag(n);
+		if (similarity > best)
+		{
+			best = similarity;
+			result[0] = (short)qx;
+			result[1] = (short)qy;
+		}
+	}
+	result[2] = 0;
+}
+
+/* pack
+ *
+ * Fill 'packed' from 'geometry'. Positions and texture coordinates
+ * are stored as 16 bit integers spread evenly over the range this
+ * mesh covers, and normals are octahedral encoded into two
+ * 16 bit integers. Over a range of width w, a position or texture
+ * coordinate is off by at most half a step, w/131068, plus float
+ * rounding in the shader. A normal is off by less than 0.01 degrees.
+ */
+void meshhdl::pack()
+{
+	packed.resize(geometry.size());
+	dirty = true;
+	if (geometry.size() == 0)
+		return;
+
+	vec8f lower = geometry[0], upper = geometry[0];
+	for (unsigned int i = 1; i < geometry.size(); i++)
+		for (int j = 0; j < 8; j++)
+		{
+			lower[j] = min(lower[j], geometry[i][j]);
+			upper[j] = max(upper[j], geometry[i][j]);
+		}
+
+	for (int j = 0; j < 3; j++)
+	{
+		position_offset[j] = (lower[j] + upper[j])/2.0f;
+		position_scale[j] = (upper[j] > lower[j] ? (upper[j] - lower[j])/65534.0f : 1.0f);
+	}
+
+	for (int j = 0; j < 2; j++)
+	{
+		texcoord_offset[j] = (lower[6+j] + upper[6+j])/2.0f;
+		texcoord_scale[j] = (upper[6+j] > lower[6+j] ? (upper[6+j] - lower[6+j])/65534.0f : 1.0f);
+	}
+
+	for (unsigned int i = 0; i < geometry.size(); i++)
+	{
+		for (int j = 0; j < 3; j++)
+			packed[i].position[j] = quantize(geometry[i][j], position_scale[j], position_offset[j]);
+		encode_normal((vec3f)geometry[i](3,6), packed[i].normal);
+		for (int j = 0; j < 2; j++)
+			packed[i].texcoord[j] = quantize(geometry[i][6+j], texcoord_scale[j], texcoord_offset[j]);
+	}
+}
+
+/* weld
+ *
+ * Merge vertices that are within 'epsilon' of each other in every
+ * attribute (position, normal and texture coordinate), and drop any
+ * triangles that collapse as a result.
+ */
+void meshhdl::weld(float epsilon)
+{
+	if (epsilon <= 0.0f || geometry.size() == 0)
+		return;
+
+	// The vertices that are kept get binned into a grid of cells that
+	// are 'epsilon' wide. Anything within epsilon of a vertex is then
+	// either in the same cell or one of the 26 around it.
+	unordered_map<long long, int> cells;
+	vector<int> next;
+	vector<vec8f> result;
+	vector<int> remap(geometry.size());
+	for (unsigned int i = 0; i < geometry.size(); i++)
+	{
+		vec3i cell((int)floor(geometry[i][0]/epsilon), (int)floor(geometry[i][1]/epsilon), (int)floor(geometry[i][2]/epsilon));
+
+		int found = -1;
+		for (int dx = -1; dx <= 1 && found < 0; dx++)
+			for (int dy = -1; dy <= 1 && found < 0; dy++)
+				for (int dz = -1; dz <= 1 && found < 0; dz++)
+				{
+					unordered_map<long long, int>::iterator head = cells.find(((long long)((cell[0]+dx) & 0x1FFFFF) << 42) | ((long long)((cell[1]+dy) & 0x1FFFFF) << 21) | (long long)((cell[2]+dz) & 0x1FFFFF));
+					for (int j = (head == cells.end() ? -1 : head->second); j >= 0 && found < 0; j = next[j])
+					{
+						bool close = true;
+						for (int k = 0; k < 8 && close; k++)
+							close = (fabs(result[j][k] - geometry[i][k]) <= epsilon);
+						if (close)
+							found = j;
+					}
+				}
+
+		if (found < 0)
+		{
+			long long key = ((long long)(cell[0] & 0x1FFFFF) << 42) | ((long long)(cell[1] & 0x1FFFFF) << 21) | (long long)(cell[2] & 0x1FFFFF);
+			unordered_map<long long, int>::iterator head = cells.find(key);
+			found = (int)result.size();
+			result.push_back(geometry[i]);
+			next.push_back(head == cells.end() ? -1 : head->second);
+			cells[key] = found;
+		}
+
+		remap[i] = found;
+	}
+
+	unsigned int j = 0;
+	for (unsigned int i = 0; i+2 < indices.size(); i += 3)
+	{
+		int a = remap[indices[i+0]];
+		int b = remap[indices[i+1]];
+		int c = remap[indices[i+2]];
+		if (a != b && b != c && c != a)
+		{
+			indices[j++] = a;
+			indices[j++] = b;
+			indices[j++] = c;
+		}
+	}
+	indices.resize(j);
+	geometry.swap(result);
+
+	// The simplified levels point at the old vertices.
+	lods.clear();
+	lod_error.clear();
+	dirty = true;
+	fingerprint = 0;
+}
+
+/* cache_misses
+ *
+ * Count the vertices that miss a FIFO cache of 'cache_size'
+ * entries when drawing 'indices'.
+ */
+static int cache_misses(const vector<int> &indices, int vertex_count, int cache_size)
+{
+	vector<int> stamp(vertex_count, -cache_size-1);
+	int misses = 0;
+	for (unsigned int i = 0; i < indices.size(); i++)
+	{
+		if (misses - stamp[indices[i]] > cache_size)
+		{
+			stamp[indices[i]] = misses;
+			misses++;
+		}
+	}
+
+	return misses;
+}
+
+/* tipsify
+ *
+ * Reorder the triangles in 'indices' so that they reuse the vertices
+ * sitting in a post-transform cache of 'cache_size' entries. This is
+ * Tipsify from Sander, Nehab and Barczak, "Fast Triangle Reordering
+ * for Vertex Locality and Reduced Overdraw". The winding of every
+ * triangle is kept.
+ */
+static vector<int> tipsify(const vector<int> &indices, int vertex_count, int cache_size)
+{
+	int triangle_count = (int)indices.size()/3;
+	if (triangle_count == 0)
+		return indices;
+
+	// List the triangles around each vertex.
+	vector<int> live(vertex_count, 0);
+	for (int i = 0; i < triangle_count*3; i++)
+		live[indices[i]]++;
+
+	vector<int> offset(vertex_count+1, 0);
+	for (int i = 0; i < vertex_count; i++)
+		offset[i+1] = offset[i] + live[i];
+
+	vector<int> adjacency(triangle_count*3);
+	vector<int> fill(offset.begin(), offset.end()-1);
+	for (int i = 0; i < triangle_count*3; i++)
+		adjacency[fill[indices[i]]++] = i/3;
+
+	vector<int> stamp(vertex_count, 0);
+	vector<bool> emitted(triangle_count, false);
+	vector<int> dead_end;
+	vector<int> candidates;
+	vector<int> result;
+	result.reserve(triangle_count*3);
+
+	int time = cache_size+1;
+	int cursor = 1;
+	int fan = 0;
+	while (fan >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex.
+		candidates.clear();
+		for (int i = offset[fan]; i < offset[fan+1]; i++)
+		{
+			int t = adjacency[i];
+			if (emitted[t])
+				continue;
+
+			for (int j = 0; j < 3; j++)
+			{
+				int v = indices[t*3 + j];
+				result.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - stamp[v] > cache_size)
+					stamp[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Fan around whichever candidate will still be in the cache
+		// after its remaining triangles are emitted, preferring the
+		// one that has been there the longest.
+		fan = -1;
+		int priority = -1;
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			int v = candidates[i];
+			if (live[v] > 0)
+			{
+				int p = 0;
+				if (time - stamp[v] + 2*live[v] <= cache_size)
+					p = time - stamp[v];
+				if (p > priority)
+				{
+					priority = p;
+					fan = v;
+				}
+			}
+		}
+
+		// Otherwise back up to a recently used vertex, and failing
+		// that, move on to the next vertex with triangles left.
+		while (fan < 0 && dead_end.size() > 0)
+		{
+			int v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0)
+				fan = v;
+		}
+
+		while (fan < 0 && cursor < vertex_count)
+		{
+			if (live[cursor] > 0)
+				fan = cursor;
+			cursor++;
+		}
+	}
+
+	// Tipsify doesn't promise to beat an order that is already good,
+	// so keep the original triangle order if it was better.
+	if (cache_misses(result, vertex_count, cache_size) > cache_misses(indices, vertex_count, cache_size))
+		return indices;
+
+	return result;
+}
+
+/* optimize
+ *
+ * Reorder the triangles for the post-transform vertex cache, then
+ * reorder the vertices into the order they are first used so that
+ * fetching them walks through memory.
+ */
+void meshhdl::optimize(int cache_size)
+{
+	int vertex_count = (int)geometry.size();
+	if (indices.size() < 3)
+		return;
+
+	vector<int> result = tipsify(indices, vertex_count, cache_size);
+
+	// Number the vertices in the order they are first used. Anything
+	// the triangles never touch goes at the end.
+	vector<int> remap(vertex_count, -1);
+	vector<vec8f> reordered;
+	reordered.reserve(vertex_count);
+	for (unsigned int i = 0; i < result.size(); i++)
+	{
+		if (remap[result[i]] < 0)
+		{
+			remap[result[i]] = (int)reordered.size();
+			reordered.push_back(geometry[result[i]]);
+		}
+		result[i] = remap[result[i]];
+	}
+
+	for (int i = 0; i < vertex_count; i++)
+		if (remap[i] < 0)
+		{
+			remap[i] = (int)reordered.size();
+			reordered.push_back(geometry[i]);
+		}
+
+	for (unsigned int i = 0; i < lods.size(); i++)
+		for (unsigned int j = 0; j < lods[i].size(); j++)
+			lods[i][j] = remap[lods[i][j]];
+
+	indices.swap(result);
+	geometry.swap(reordered);
+	dirty = true;
+	fingerprint = 0;
+}
+
+/* acmr
+ *
+ * Compute the average cache miss ratio of the index buffer: the
+ * number of vertices a FIFO post-transform cache of 'cache_size'
+ * entries has to transform per triangle drawn.
+ */
+float meshhdl::acmr(int cache_size)
+{
+	int triangle_count = (int)indices.size()/3;
+	if (triangle_count == 0)
+		return 0.0f;
+
+	return (float)cache_misses(indices, (int)geometry.size(), cache_size)/(float)triangle_count;
+}
+
+/* This is the quadric error metric from Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics". It holds
+ * the upper triangle of a symmetric 4x4 matrix whose product with
+ * a point is the sum of the squared distances from that point to
+ * a set of planes.
+ */
+struct quadrichdl
+{
+	quadrichdl()
+	{
+		for (int i = 0; i < 10; i++)
+			q[i] = 0.0;
+	}
+
+	// xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+	double q[10];
+
+	void add_plane(double a, double b, double c, double d)
+	{
+		q[0] += a*a; q[1] += a*b; q[2] += a*c; q[3] += a*d;
+		q[4] += b*b; q[5] += b*c; q[6] += b*d;
+		q[7] += c*c; q[8] += c*d;
+		q[9] += d*d;
+	}
+
+	quadrichdl &operator+=(const quadrichdl &o)
+	{
+		for (int i = 0; i < 10; i++)
+			q[i] += o.q[i];
+		return *this;
+	}
+
+	double error(vec3f p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double result = q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x +
+						q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y +
+						q[7]*z*z + 2.0*q[8]*z +
+						q[9];
+		return result > 0.0 ? result : 0.0;
+	}
+};
+
+/* A candidate for moving the corner 'from' onto the corner 'to'.
+ * The versions are used to throw away candidates whose cost was
+ * computed before either corner last changed.
+ */
+struct collapsehdl
+{
+	double cost;
+	int from, to;
+	int from_version, to_version;
+
+	bool operator<(const collapsehdl &c) const
+	{
+		return cost > c.cost;
+	}
+};
+
+/* generate_lods
+ *
+ * Build up to 'levels' simplified versions of this mesh, each
+ * with about half the triangles of the last. Edges are collapsed in
+ * order of their quadric error, always moving one end onto the other
+ * so that every level can share the same vertices. Corners on the
+ * border of the mesh are never moved. Where the normals or texture
+ * coordinates split along a seam, a corner may only slide along the
+ * seam. A collapse is also skipped if it would flip a triangle or
+ * pinch the surface.
+ */
+void meshhdl::generate_lods(int levels)
+{
+	// Meshes smaller than this aren't worth simplifying
+	const int min_triangles = 64;
+
+	lods.clear();
+	lod_error.clear();
+	dirty = true;
+	fingerprint = 0;
+
+	int vertex_count = (int)geometry.size();
+	int triangle_count = (int)indices.size()/3;
+	if (triangle_count/2 < min_triangles)
+		return;
+
+	// Vertices that share a position are a single corner of the
+	// surface. Find them by sorting.
+	vector<int> order(vertex_count);
+	for (int i = 0; i < vertex_count; i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), [&](int a, int b) {
+		for (int k = 0; k < 3; k++)
+			if (geometry[a][k] != geometry[b][k])
+				return geometry[a][k] < geometry[b][k];
+		return a < b;
+	});
+
+	vector<int> corner(vertex_count);
+	vector<vec3f> position;
+	for (int i = 0; i < vertex_count; i++)
+	{
+		if (i == 0 || (vec3f)geometry[order[i]](0,3) != position.back())
+			position.push_back((vec3f)geometry[order[i]](0,3));
+		corner[order[i]] = (int)position.size()-1;
+	}
+	int corner_count = (int)position.size();
+	vector<bool> locked(corner_count, false);
+
+	vector<int> triangles = indices;
+	vector<bool> dead(triangle_count, false);
+	vector<vector<int> > around(corner_count);
+	vector<quadrichdl> quadric(corner_count);
+	unordered_map<long long, int> edges;
+	for (int t = 0; t < triangle_count; t++)
+	{
+		int c[3] = {corner[triangles[t*3+0]], corner[triangles[t*3+1]], corner[triangles[t*3+2]]};
+		for (int j = 0; j < 3; j++)
+		{
+			around[c[j]].push_back(t);
+			edges[((long long)min(c[j], c[(j+1)%3]) << 32) | (long long)max(c[j], c[(j+1)%3])]++;
+		}
+
+		vec3f n = cross(position[c[1]] - position[c[0]], position[c[2]] - position[c[0]]);
+		float length = mag(n);
+		if (length > 0.0f)
+		{
+			n /= length;
+			for (int j = 0; j < 3; j++)
+				quadric[c[j]].add_plane(n[0], n[1], n[2], -dot(n, position[c[0]]));
+		}
+	}
+
+	for (unordered_map<long long, int>::iterator i = edges.begin(); i != edges.end(); i++)
+		if (i->second != 2)
+		{
+			locked[(int)(i->first >> 32)] = true;
+			locked[(int)(i->first & 0xFFFFFFFF)] = true;
+		}
+
+	vector<int> version(corner_count, 0);
+	vector<bool> removed(corner_count, false);
+	priority_queue<collapsehdl> candidates;
+	for (unordered_map<long long, int>::iterator i = edges.begin(); i != edges.end(); i++)
+	{
+		int a = (int)(i->first >> 32), b = (int)(i->first & 0xFFFFFFFF);
+		for (int j = 0; j < 2; j++, swap(a, b))
+			if (!locked[a])
+			{
+				quadrichdl q = quadric[a];
+				q += quadric[b];
+				collapsehdl c = {q.error(position[b]), a, b, 0, 0};
+				candidates.push(c);
+			}
+	}
+
+	int live = triangle_count;
+	int target = triangle_count/2;
+	double worst = 0.0;
+	vector<int> from_neighbors, to_neighbors, shared;
+	vector<vec2i> moves;
+	while ((int)lods.size() < levels && target >= min_triangles && !candidates.empty())
+	{
+		collapsehdl c = candidates.top();
+		candidates.pop();
+		if (removed[c.from] || removed[c.to] || version[c.from] != c.from_version || version[c.to] != c.to_version)
+			continue;
+
+		// Gather the corners around each end. Each triangle that
+		// collapses pairs a vertex at 'from' with the vertex at 'to'
+		// that it gets replaced with.
+		from_neighbors.clear();
+		to_neighbors.clear();
+		moves.clear();
+		int edge_triangles = 0;
+		for (unsigned int i = 0; i < around[c.from].size(); i++)
+		{
+			int t = around[c.from][i];
+			if (dead[t])
+				continue;
+
+			int u = -1, w = -1;
+			for (int j = 0; j < 3; j++)
+			{
+				int k = corner[triangles[t*3+j]];
+				from_neighbors.push_back(k);
+				if (k == c.from)
+					u = triangles[t*3+j];
+				else if (k == c.to)
+					w = triangles[t*3+j];
+			}
+
+			if (w >= 0)
+			{
+				moves.push_back(vec2i(u, w));
+				edge_triangles++;
+			}
+		}
+		for (unsigned int i = 0; i < around[c.to].size(); i++)
+		{
+			int t = around[c.to][i];
+			if (!dead[t])
+				for (int j = 0; j < 3; j++)
+					to_neighbors.push_back(corner[triangles[t*3+j]]);
+		}
+
+		if (edge_triangles == 0)
+			continue;
+
+		// The ends may only share the corners opposite the edge,
+		// otherwise the collapse pinches the surface.
+		sort(from_neighbors.begin(), from_neighbors.end());
+		from_neighbors.erase(unique(from_neighbors.begin(), from_neighbors.end()), from_neighbors.end());
+		sort(to_neighbors.begin(), to_neighbors.end());
+		to_neighbors.erase(unique(to_neighbors.begin(), to_neighbors.end()), to_neighbors.end());
+		shared.clear();
+		set_intersection(from_neighbors.begin(), from_neighbors.end(), to_neighbors.begin(), to_neighbors.end(), back_inserter(shared));
+		if ((int)shared.size() > edge_triangles + 2)
+			continue;
+
+		bool valid = true;
+		for (unsigned int i = 0; i < around[c.from].size() && valid; i++)
+		{
+			int t = around[c.from][i];
+			if (dead[t])
+				continue;
+
+			vec3f p[3], q[3];
+			bool collapses = false;
+			for (int j = 0; j < 3; j++)
+			{
+				int k = corner[triangles[t*3+j]];
+				p[j] = position[k];
+				q[j] = (k == c.from ? position[c.to] : position[k]);
+				collapses = collapses || k == c.to;
+			}
+
+			if (!collapses)
+			{
+				// Every vertex at 'from' needs exactly one place to go,
+				// otherwise this would tear a seam open.
+				int u = -1;
+				for (int j = 0; j < 3; j++)
+					if (corner[triangles[t*3+j]] == c.from)
+						u = triangles[t*3+j];
+
+				int found = -1;
+				for (unsigned int j = 0; j < moves.size() && valid; j++)
+					if (moves[j][0] == u)
+					{
+						valid = (found < 0 || found == moves[j][1]);
+						found = moves[j][1];
+					}
+				valid = valid && found >= 0;
+
+				vec3f before = cross(p[1] - p[0], p[2] - p[0]);
+				vec3f after = cross(q[1] - q[0], q[2] - q[0]);
+				valid = valid && (dot(before, after) > 0.2f*mag(before)*mag(after));
+			}
+		}
+
+		if (!valid)
+			continue;
+
+		for (unsigned int i = 0; i < around[c.from].size(); i++)
+		{
+			int t = around[c.from][i];
+			if (dead[t])
+				continue;
+
+			bool collapsed = false;
+			for (int j = 0; j < 3; j++)
+				collapsed = collapsed || corner[triangles[t*3+j]] == c.to;
+
+			if (collapsed)
+			{
+				dead[t] = true;
+				live--;
+			}
+			else
+			{
+				for (int j = 0; j < 3; j++)
+					if (corner[triangles[t*3+j]] == c.from)
+						for (unsigned int k = 0; k < moves.size(); k++)
+							if (moves[k][0] == triangles[t*3+j])
+							{
+								triangles[t*3+j] = moves[k][1];
+								break;
+							}
+				around[c.to].push_back(t);
+			}
+		}
+
+		removed[c.from] = true;
+		around[c.from].clear();
+		quadric[c.to] += quadric[c.from];
+		version[c.to]++;
+		worst = max(worst, c.cost);
+
+		// The cost of every edge at 'to' has changed.
+		unsigned int j = 0;
+		for (unsigned int i = 0; i < around[c.to].size(); i++)
+			if (!dead[around[c.to][i]])
+				around[c.to][j++] = around[c.to][i];
+		around[c.to].resize(j);
+
+		for (unsigned int i = 0; i < to_neighbors.size(); i++)
+		{
+			int n = to_neighbors[i];
+			if (n == c.to || n == c.from || removed[n])
+				continue;
+
+			quadrichdl q = quadric[c.to];
+			q += quadric[n];
+			if (!locked[c.to])
+			{
+				collapsehdl d = {q.error(position[n]), c.to, n, version[c.to], version[n]};
+				candidates.push(d);
+			}
+			if (!locked[n])
+			{
+				collapsehdl d = {q.error(position[c.to]), n, c.to, version[n], version[c.to]};
+				candidates.push(d);
+			}
+		}
+		for (unsigned int i = 0; i < from_neighbors.size(); i++)
+		{
+			int n = from_neighbors[i];
+			if (n == c.to || n == c.from || removed[n] || binary_search(to_neighbors.begin(), to_neighbors.end(), n))
+				continue;
+
+			quadrichdl q = quadric[c.to];
+			q += quadric[n];
+			if (!locked[c.to])
+			{
+				collapsehdl d = {q.error(position[n]), c.to, n, version[c.to], version[n]};
+				candidates.push(d);
+			}
+			if (!locked[n])
+			{
+				collapsehdl d = {q.error(position[c.to]), n, c.to, version[n], version[c.to]};
+				candidates.push(d);
+			}
+		}
+
+		if (live <= target)
+		{
+			vector<int> level;
+			level.reserve(live*3);
+			for (int t = 0; t < triangle_count; t++)
+				if (!dead[t])
+					for (int k = 0; k < 3; k++)
+						level.push_back(triangles[t*3+k]);
+
+			lods.push_back(tipsify(level, vertex_count, 16));
+			lod_error.push_back((float)sqrt(worst));
+			target = live/2;
+		}
+	}
+}
+
+/* select_lod
+ *
+ * Pick the level to draw given how many pixels one unit in object
+ * space covers on screen. The coarsest level whose error stays under
+ * 'tolerance' pixels is chosen, but a level is only left once it is
+ * well past the tolerance in either direction so that objects near
+ * the threshold don't flicker between levels.
+ */
+void rigidhdl::select_lod(float pixels, float tolerance)
+{
+	const vector<float> &lod_error = mesh->lod_error;
+	if (lod > (int)lod_error.size())
+		lod = (int)lod_error.size();
+
+	while (lod > 0 && lod_error[lod-1]*pixels > tolerance*1.25f)
+		lod--;
+
+	while (lod < (int)lod_error.size() && lod_error[lod]*pixels < tolerance*0.8f)
+		lod++;
 }
 
 objecthdl::objecthdl()
 {
-	position = vec3f(0.0, 0.0, 0.0);
-	orientation = vec3f(0.0, 0.0, 0.0);
 	bound = vec6f(1.0e6, -1.0e6, 1.0e6, -1.0e6, 1.0e6, -1.0e6);
-	scale = 1.0;
+	lod_tolerance = 1.0;
+	proxy = -1;
+	proxy_version = 0;
+	is_light = false;
+	is_camera = false;
 }
 
-objecthdl::objecthdl(const objecthdl &o)
+/* A copy isn't in the tree of any scene until it is added to one. */
+objecthdl::objecthdl(const objecthdl &o) : transformhdl(o)
 {
-	position = o.position;
-	orientation = o.orientation;
 	bound = o.bound;
-	scale = o.scale;
+	lod_tolerance = o.lod_tolerance;
+	proxy = -1;
+	proxy_version = 0;
+	is_light = false;
+	is_camera = false;
 	rigid = o.rigid;
 	for (map<string, materialhdl*>::const_iterator i = o.material.begin(); i != o.material.end(); i++)
 		material.insert(pair<string, materialhdl*>(i->first, i->second->clone()));
@@ -68,78 +1231,177 @@ objecthdl::~objecthdl()
 	material.clear();
 }
 
-/* draw
+/* set_format
+ *
+ * Choose the vertex format that every rigid body of this
+ * object is drawn with.
+ */
+void objecthdl::set_format(int format)
+{
+	for (unsigned int i = 0; i < rigid.size(); i++)
+	{
+		rigid[i].format = format;
+		if (format == rigidhdl::packed_vertices && rigid[i].mesh->packed.size() != rigid[i].mesh->geometry.size())
+			rigid[i].mesh->pack();
+	}
+}
+
+/* world_bound
  *
- * Draw the model. Don't forget to apply the transformations necessary
- * for position, orientation, and scale.
+ * Find the world space bounding box of the bounding box. Objects
+ * without any geometry get an empty box at their position.
  */
-void objecthdl::draw(const vector<lighthdl*> &lights)
+vec6f objecthdl::world_bound()
 {
-    glTranslatef(position[0], position[1], position[2]);
-    glRotatef(radtodeg(orientation[0]), 1.0, 0.0, 0.0);
-    glRotatef(radtodeg(orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(orientation[2]), 0.0, 0.0, 1.0);
-    glScalef(scale, scale, scale);
+	const mat4f &world = world_matrix();
+	if (bound[0] > bound[1] || bound[2] > bound[3] || bound[4] > bound[5])
+		return vec6f(world[0][3], world[0][3], world[1][3], world[1][3], world[2][3], world[2][3]);
+
+	return transform_bound(world, bound);
+}
 
+/* update_proxy
+ *
+ * Place this object's leaf in 'tree' as 'item', inserting it if it
+ * doesn't have one. The world bound is only found again when the
+ * world matrix or the bound has changed since the last time.
+ */
+void objecthdl::update_proxy(aabbtreehdl &tree, int item)
+{
+	world_matrix();
+	if (proxy < 0)
+	{
+		proxy = tree.insert(world_bound(), item);
+		proxy_version = version;
+		proxy_bound = bound;
+		return;
+	}
+
+	tree.nodes[proxy].item = item;
+	if (proxy_version != version || proxy_bound != bound)
+	{
+		tree.move(proxy, world_bound());
+		proxy_version = version;
+		proxy_bound = bound;
+	}
+}
+
+/* in_frustum
+ *
+ * Check the bounding box against the planes of the view frustum,
+ * given the camera's projection times view matrix. The planes are
+ * moved into object space so that the box doesn't have to be
+ * moved into clip space. This returns false only if the whole box
+ * is outside of one of the planes, so it can return true for some
+ * boxes that are just past a corner of the frustum.
+ */
+bool objecthdl::in_frustum(const mat4f &view_projection)
+{
+	// Objects without any geometry don't have a bound yet.
+	if (bound[0] > bound[1] || bound[2] > bound[3] || bound[4] > bound[5])
+		return true;
+
+	mat4f m = view_projection*world_matrix();
+	vec3f center((bound[0] + bound[1])/2.0, (bound[2] + bound[3])/2.0, (bound[4] + bound[5])/2.0);
+	vec3f half((bound[1] - bound[0])/2.0, (bound[3] - bound[2])/2.0, (bound[5] - bound[4])/2.0);
+
+	// A point is inside when -w <= x, y, z <= w in clip space.
+	for (int i = 0; i < 3; i++)
+		for (int side = -1; side <= 1; side += 2)
+		{
+			float plane[4];
+			for (int j = 0; j < 4; j++)
+				plane[j] = m[3][j] - (float)side*m[i][j];
+
+			float distance = plane[0]*center[0] + plane[1]*center[1] + plane[2]*center[2] + plane[3];
+			float extent = fabs(plane[0])*half[0] + fabs(plane[1])*half[1] + fabs(plane[2])*half[2];
+			if (distance + extent < 0.0f)
+				return false;
+		}
+
+	return true;
+}
+
+/* pixels_per_unit
+ *
+ * Work out how many pixels one unit of the model covers at the
+ * point of its bounding box closest to the camera, given the
+ * modelview and projection matrices and the viewport's height.
+ */
+float objecthdl::pixels_per_unit(const mat4f &modelview, const mat4f &projection, int height)
+{
+    vec3f center((bound[0] + bound[1])/2.0, (bound[2] + bound[3])/2.0, (bound[4] + bound[5])/2.0);
+    float radius = mag(vec3f(bound[1] - bound[0], bound[3] - bound[2], bound[5] - bound[4]))/2.0;
+    float units = mag(vec3f(modelview[0][0], modelview[1][0], modelview[2][0]));
+    float w = (projection*modelview*vec4f(center[0], center[1], center[2], 1.0))[3] - fabs(projection[3][2])*radius*units;
+    return (w > 0.0f ? fabs(projection[1][1])*units*(float)height*0.5f/w : 1.0e30f);
+}
+
+/* enqueue
+ *
+ * Select the level of detail of each rigid body and add them
+ * to the render queue instead of drawing them right away.
+ */
+void objecthdl::enqueue(queuehdl &queue, const mat4f &view, const mat4f &projection, int height)
+{
+    mat4f modelview = view*world_matrix();
+    float pixels = pixels_per_unit(modelview, projection, height);
+
+    vec3f center((bound[0] + bound[1])/2.0, (bound[2] + bound[3])/2.0, (bound[4] + bound[5])/2.0);
+    float depth = -(modelview*vec4f(center[0], center[1], center[2], 1.0))[2];
+
+    int transform = queue.push_transform(modelview);
     for (unsigned int i = 0; i < rigid.size(); i++)
     {
-        material[rigid[i].material]->apply(lights);
-        rigid[i].draw();
+        rigid[i].select_lod(pixels, lod_tolerance);
+        queue.push(&rigid[i], material[rigid[i].material], transform, depth);
     }
-
-    glScalef(1.0/scale, 1.0/scale, 1.0/scale);
-    glRotatef(radtodeg(-orientation[2]), 0.0, 0.0, 1.0);
-    glRotatef(radtodeg(-orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(-orientation[0]), 1.0, 0.0, 0.0);
-    glTranslatef(-position[0], -position[1], -position[2]);
 }
 
 /* draw_bound
  *
- * Create a representation for the bounding box and
- * render it.
+ * Draw the bounding box of this object as a wire frame. Every box
+ * is the unit cube moved and stretched onto the bound, so the lines
+ * are put on the GPU once and shared.
  */
 void objecthdl::draw_bound()
 {
-    glTranslatef(position[0], position[1], position[2]);
-    glRotatef(radtodeg(orientation[0]), 1.0, 0.0, 0.0);
-    glRotatef(radtodeg(orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(orientation[2]), 0.0, 0.0, 1.0);
-    glScalef(scale, scale, scale);
-
-	vector<vec8f> bound_geometry;
-	vector<int> bound_indices;
-	bound_geometry.reserve(8);
-	bound_geometry.push_back(vec8f(bound[0], bound[2], bound[4], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[1], bound[2], bound[4], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[1], bound[3], bound[4], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[0], bound[3], bound[4], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[0], bound[2], bound[5], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[1], bound[2], bound[5], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[1], bound[3], bound[5], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_geometry.push_back(vec8f(bound[0], bound[3], bound[5], 0.0, 0.0, 0.0, 0.0, 0.0));
-	bound_indices.reserve(24);
-	for (unsigned int i = 0; i < 4; i++)
-	{
-		bound_indices.push_back(i);
-		bound_indices.push_back((i+1)%4);
-		bound_indices.push_back(4+i);
-		bound_indices.push_back(4+(i+1)%4);
-		bound_indices.push_back(i);
-		bound_indices.push_back(4+i);
-	}
-
-    whitehdl w;
-    w.apply(std::vector<lighthdl*>());
+	if (bound_buffer == 0)
+	{
+		vec3f corners[8];
+		for (int i = 0; i < 8; i++)
+			corners[i] = vec3f((float)((i^(i>>1))&1), (float)((i>>1)&1), (float)((i>>2)&1));
+
+		vector<vec3f> lines;
+		lines.reserve(24);
+		for (int i = 0; i < 4; i++)
+		{
+			lines.push_back(corners[i]);
+			lines.push_back(corners[(i+1)%4]);
+			lines.push_back(corners[4+i]);
+			lines.push_back(corners[4+(i+1)%4]);
+			lines.push_back(corners[i]);
+			lines.push_back(corners[4+i]);
+		}
+
+		glGenBuffers(1, &bound_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, bound_buffer);
+		glBufferData(GL_ARRAY_BUFFER, lines.size()*sizeof(vec3f), lines.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	push();
+	glTranslatef(bound[0], bound[2], bound[4]);
+	glScalef(bound[1] - bound[0], bound[3] - bound[2], bound[5] - bound[4]);
+
+	line_material.bind();
+	glBindBuffer(GL_ARRAY_BUFFER, bound_buffer);
 	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(3, GL_FLOAT, sizeof(float)*8, (float*)bound_geometry.data());
-	glDrawElements(GL_LINES, (int)bound_indices.size(), GL_UNSIGNED_INT, bound_indices.data());
+	glVertexPointer(3, GL_FLOAT, sizeof(vec3f), (void*)0);
+	glDrawArrays(GL_LINES, 0, 24);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glScalef(1.0/scale, 1.0/scale, 1.0/scale);
-    glRotatef(radtodeg(-orientation[2]), 0.0, 0.0, 1.0);
-    glRotatef(radtodeg(-orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(-orientation[0]), 1.0, 0.0, 0.0);
-    glTranslatef(-position[0], -position[1], -position[2]);
+	pop();
 }
 
 /* draw_normals
@@ -155,62 +1417,11 @@ void objecthdl::draw_normals(bool face)
 		if (abs(bound[i]) > radius)
 			radius = abs(bound[i]);
 
-	vector<vec8f> normal_geometry;
-	vector<int> normal_indices;
-
-    glTranslatef(position[0], position[1], position[2]);
-    glRotatef(radtodeg(orientation[0]), 1.0, 0.0, 0.0);
-    glRotatef(radtodeg(orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(orientation[2]), 0.0, 0.0, 1.0);
-    glScalef(scale, scale, scale); 
+	push();
 
+	line_material.bind();
 	for (unsigned int i = 0; i < rigid.size(); i++)
-	{
-		if (!face)
-		{
-			for (unsigned int j = 0; j < rigid[i].geometry.size(); j++)
-			{
-				normal_indices.push_back(normal_geometry.size());
-				normal_geometry.push_back(rigid[i].geometry[j]);
-				normal_geometry.back().set(3,6,vec3f(0.0, 0.0, 0.0));
-				normal_indices.push_back(normal_geometry.size());
-				normal_geometry.push_back(rigid[i].geometry[j]);
-				normal_geometry.back().set(0,3,(vec3f)(normal_geometry.back()(0,3) + radius*0.1f*normal_geometry.back()(3,6)));
-				normal_geometry.back().set(3,6,vec3f(0.0, 0.0, 0.0));
-			}
-		}
-		else
-		{
-			for (unsigned int j = 0; j < rigid[i].indices.size(); j+=3)
-			{
-				vec3f normal = norm((vec3f)rigid[i].geometry[rigid[i].indices[j + 0]](3,6) +
-									(vec3f)rigid[i].geometry[rigid[i].indices[j + 1]](3,6) +
-									(vec3f)rigid[i].geometry[rigid[i].indices[j + 2]](3,6));
-				vec3f center = ((vec3f)rigid[i].geometry[rigid[i].indices[j + 0]](0,3) +
-								(vec3f)rigid[i].geometry[rigid[i].indices[j + 1]](0,3) +
-								(vec3f)rigid[i].geometry[rigid[i].indices[j + 2]](0,3))/3.0f;
-				normal_indices.push_back(normal_geometry.size());
-				normal_geometry.push_back(center);
-				normal_geometry.back().set(3,8,vec5f(0.0, 0.0, 0.0, 0.0, 0.0));
-				normal_indices.push_back(normal_geometry.size());
-				normal_geometry.push_back(center + radius*0.1f*normal);
-				normal_geometry.back().set(3,8,vec5f(0.0, 0.0, 0.0, 0.0, 0.0));
-			}
-		}
-
-        whitehdl w;
-        w.apply(std::vector<lighthdl*>());
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glVertexPointer(3, GL_FLOAT, sizeof(float)*8, (float*)normal_geometry.data());
-        glDrawElements(GL_LINES, (int)normal_indices.size(), GL_UNSIGNED_INT, normal_indices.data());
-
-		normal_geometry.clear();
-		normal_indices.clear();
-	}
+		rigid[i].mesh->draw_normals(face, radius*0.1f);
 
-    glScalef(1.0/scale, 1.0/scale, 1.0/scale);
-    glRotatef(radtodeg(-orientation[2]), 0.0, 0.0, 1.0);
-    glRotatef(radtodeg(-orientation[1]), 0.0, 1.0, 0.0);
-    glRotatef(radtodeg(-orientation[0]), 1.0, 0.0, 0.0);
-    glTranslatef(-position[0], -position[1], -position[2]);
+	pop();
 }
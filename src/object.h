@@ -8,15 +8,106 @@
 #include "core/geometry.h"
 #include "standard.h"
 #include "opengl.h"
+#include <memory>
 
 #include "material.h"
+#include "transform.h"
+#include "queue.h"
+#include "bvh.h"
+#include "tree.h"
 
 using namespace core;
 
 #ifndef object_h
 #define object_h
 
-struct lighthdl;
+/* A vertex packed into 16 bytes, half the size of a vec8f. See
+ * meshhdl::pack for the encoding. The third normal component
+ * is always zero and only there because glNormalPointer reads
+ * three of them.
+ */
+struct packedhdl
+{
+	short position[3];
+	short normal[3];
+	short texcoord[2];
+};
+
+/* The vertices and indices of a rigid body along with everything
+ * derived from them: the levels of detail, the packed vertices and
+ * the GPU buffers. Rigid bodies hold their mesh through a shared
+ * pointer so that copies of an object, and primitives or models
+ * made from the same parameters or file, all use one mesh. Once a
+ * mesh might be shared its vertices and indices must not change,
+ * go through rigidhdl::edit() which makes a private copy first.
+ */
+struct meshhdl
+{
+	meshhdl();
+	meshhdl(const meshhdl &m);
+	~meshhdl();
+
+	vector<vec8f> geometry;
+	vector<int> indices;
+
+	// Simplified versions of 'indices' from finest to coarsest.
+	// They all index into 'geometry'. lod_error[i] estimates how
+	// far, in object space, lods[i] strays from the full mesh.
+	vector<vector<int> > lods;
+	vector<float> lod_error;
+
+	// A copy of 'geometry' made by pack() along with the scales and
+	// offsets that the vertex shaders use to decode it.
+	vector<packedhdl> packed;
+	vec3f position_scale, position_offset;
+	vec2f texcoord_scale, texcoord_offset;
+
+	// GPU copies of the vertices and of the indices of every level,
+	// made on the first draw. Set 'dirty' after changing any of them
+	// so that the next draw uploads them again.
+	GLuint vertex_array;
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	int uploaded_format;
+	vector<int> level_offset;
+	bool dirty;
+
+	// Cached by hash(), or 0 if it hasn't been computed. Clear it
+	// along with setting 'dirty' if the geometry or indices change.
+	unsigned long long fingerprint;
+
+	// Lines along the normal of every vertex [0] or of every
+	// triangle [1] that draw_normals() keeps on the GPU. They are
+	// made again if the length or the fingerprint changes.
+	GLuint normal_buffer[2];
+	int normal_count[2];
+	float normal_length[2];
+	unsigned long long normal_fingerprint[2];
+
+	// A bounding volume hierarchy over the triangles of 'indices'
+	// for ray casting, made by update_bvh().
+	bvhhdl bvh;
+
+	// What this mesh is filed under in the mesh cache, or empty
+	// if it isn't in the cache.
+	string key;
+
+	meshhdl &operator=(const meshhdl &m);
+
+	unsigned long long hash();
+	void weld(float epsilon);
+	void optimize(int cache_size = 16);
+	float acmr(int cache_size = 16);
+	void generate_lods(int levels = 4);
+	void pack();
+	void upload(int vertex_format);
+	void release();
+	void draw_normals(bool face, float length);
+	void update_bvh();
+
+	static shared_ptr<meshhdl> find(string key);
+	static shared_ptr<meshhdl> share(string key, shared_ptr<meshhdl> mesh);
+};
 
 /* This represents a rigid body, which
  * is just a group of geometry to be
@@ -30,14 +121,28 @@ struct rigidhdl
 	rigidhdl();
 	~rigidhdl();
 
-	vector<vec8f> geometry;
-	vector<int> indices;
+	shared_ptr<meshhdl> mesh;
 	string material;
 
-	void draw();
+	// The level drawn, where 0 is 'indices' and i is lods[i-1].
+	int lod;
+
+	enum
+	{
+		float_vertices = 0,
+		packed_vertices = 1
+	};
+
+	// Which vertices draw() streams to the GPU, the mesh's
+	// 'geometry' as is or its 'packed' copy.
+	int format;
+
+	meshhdl &edit();
+	void draw(const programhdl *uniforms = NULL, int instances = 0, GLuint instance_buffer = 0, size_t offset = 0);
+	void select_lod(float pixels, float tolerance);
 };
 
-struct objecthdl
+struct objecthdl : transformhdl
 {
 	objecthdl();
 	objecthdl(const objecthdl &o);
@@ -46,15 +151,30 @@ struct objecthdl
 	vector<rigidhdl> rigid;
 	map<string, materialhdl*> material;
 
-	vec3f position;
-	vec3f orientation;
-	float scale;
+	// The largest error in pixels that level of detail
+	// selection will allow on screen.
+	float lod_tolerance;
 
 	// The bounding box of this object
 	// (left, right, bottom, top, front, back)
 	vec6f bound;
 
-	void draw(const vector<lighthdl*> &lights);
+	// This object's leaf in the tree of its scene, -1 if it doesn't
+	// have one, and the world matrix version and bound that the leaf
+	// was last placed with. These and whether it is the model of a
+	// light or a camera are kept up to date by scenehdl::update().
+	int proxy;
+	unsigned int proxy_version;
+	vec6f proxy_bound;
+	bool is_light;
+	bool is_camera;
+
+	void set_format(int format);
+	vec6f world_bound();
+	void update_proxy(aabbtreehdl &tree, int item);
+	bool in_frustum(const mat4f &view_projection);
+	float pixels_per_unit(const mat4f &modelview, const mat4f &projection, int height);
+	void enqueue(queuehdl &queue, const mat4f &view, const mat4f &projection, int height);
 	void draw_bound();
 	void draw_normals(bool face = false);
 };
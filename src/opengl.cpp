@@ -89,3 +89,118 @@ GLuint load_shader_file(string filename, GLuint type)
 {
 	return load_shader_source(get_source(filename), type);
 }
+
+/* link_program
+ *
+ * Link a vertex and a fragment shader into a program, with the
+ * per instance attributes at the locations the render queue
+ * expects them.
+ */
+GLuint link_program(GLuint vertex, GLuint fragment)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	glBindAttribLocation(program, instance_attribute, "instance_modelview");
+	glLinkProgram(program);
+	return program;
+}
+
+/* gl_version_at_least
+ *
+ * Check the version of the current context.
+ */
+bool gl_version_at_least(int major, int minor)
+{
+	const char *version = (const char*)glGetString(GL_VERSION);
+	if (version == NULL)
+		return false;
+
+	int context_major = 0, context_minor = 0;
+	char dot = 0;
+	istringstream in(version);
+	in >> context_major >> dot >> context_minor;
+	return context_major > major || (context_major == major && context_minor >= minor);
+}
+
+/* uniform_buffers_supported
+ *
+ * Check whether the context can give the shaders the lights block
+ * in res/light.glsl, which needs OpenGL 3.1 or the uniform buffer
+ * object extension.
+ */
+bool uniform_buffers_supported()
+{
+#ifdef __GLEW_H__
+	return GLEW_VERSION_3_1 || GLEW_ARB_uniform_buffer_object;
+#else
+	if (gl_version_at_least(3, 1))
+		return true;
+
+	const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+	return extensions != NULL && strstr(extensions, "GL_ARB_uniform_buffer_object") != NULL;
+#endif
+}
+
+static const char *uniform_names[uniform_count] = {
+	"emission",
+	"ambient",
+	"diffuse",
+	"specular",
+	"shininess",
+	"tex",
+	"packed_vertices",
+	"position_scale",
+	"position_offset",
+	"texcoord_scale",
+	"texcoord_offset",
+	"instanced",
+	"id"
+};
+
+programhdl::programhdl()
+{
+	reflect(0);
+}
+
+programhdl::~programhdl()
+{
+}
+
+/* reflect
+ *
+ * Fill in the table of locations from the active uniforms of
+ * 'program', which must already be linked, and attach its
+ * lights block to the shared binding point.
+ */
+void programhdl::reflect(GLuint program)
+{
+	this->program = program;
+	for (int i = 0; i < uniform_count; i++)
+		location[i] = -1;
+
+	if (program == 0)
+		return;
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	vector<char> buffer(max_length + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program, i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+		string name(buffer.data(), length);
+		GLint loc = glGetUniformLocation(program, name.c_str());
+
+		for (int j = 0; j < uniform_count; j++)
+			if (name == uniform_names[j])
+				location[j] = loc;
+	}
+
+	GLuint block = glGetUniformBlockIndex(program, "lights");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block, light_binding);
+}
@@ -3,6 +3,12 @@
 
 #if defined(OSX_CORE3) || defined(OSX_CORE2) || defined(__APPLE__)
     #include <GLUT/glut.h>
+    #if defined(OSX_CORE2)
+        // The 2.1 framework only has the APPLE vertex array objects
+        #define glGenVertexArrays glGenVertexArraysAPPLE
+        #define glBindVertexArray glBindVertexArrayAPPLE
+        #define glDeleteVertexArrays glDeleteVertexArraysAPPLE
+    #endif
 #else
     #include <GL/glew.h>
     #include <GL/glut.h>
@@ -15,5 +21,58 @@
 
 GLuint load_shader_file(string filename, GLenum type);
 GLuint load_shader_source(string source, GLenum type);
+GLuint link_program(GLuint vertex, GLuint fragment);
+bool gl_version_at_least(int major, int minor);
+bool uniform_buffers_supported();
+
+// The uniforms that our shaders use, outside of the light arrays.
+enum
+{
+	uniform_emission = 0,
+	uniform_ambient,
+	uniform_diffuse,
+	uniform_specular,
+	uniform_shininess,
+	uniform_tex,
+	uniform_packed_vertices,
+	uniform_position_scale,
+	uniform_position_offset,
+	uniform_texcoord_scale,
+	uniform_texcoord_offset,
+	uniform_instanced,
+	uniform_id,
+	uniform_count
+};
+
+// The length of each light array in res/light.glsl.
+const int max_lights = 4;
+
+// The uniform buffer binding point of the lights block in
+// res/light.glsl. Every program that uses it reads from the
+// same buffer, which the scene fills once per frame.
+const GLuint light_binding = 0;
+
+// The first of the four attribute locations of the per instance
+// modelview matrix in res/vertex.glsl. The built in attributes
+// that these may alias, the texture coordinates past the first,
+// aren't used by our shaders.
+const GLuint instance_attribute = 12;
+
+/* This is the table of uniform locations for one linked
+ * program. It is filled in once by asking the program for
+ * all of its active uniforms, so setting a uniform doesn't
+ * need to look up its name. Uniforms that the program
+ * doesn't use are left at -1, which glUniform ignores.
+ */
+struct programhdl
+{
+	programhdl();
+	~programhdl();
+
+	GLuint program;
+	GLint location[uniform_count];
+
+	void reflect(GLuint program);
+};
 
 #endif
@@ -0,0 +1,78 @@
+/*
+ * pick.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "pick.h"
+#include "scene.h"
+#include "object.h"
+
+pickhdl::pickhdl()
+{
+	object = -1;
+	rigid = -1;
+	triangle = -1;
+	t = 0.0f;
+}
+
+pickhdl::~pickhdl()
+{
+}
+
+/* pick
+ *
+ * Find the nearest surface along the ray from 'origin' along
+ * 'direction' in world space, and return the index of its object in
+ * the scene or -1 if the ray doesn't hit anything. This goes by the
+ * tree, the roles and the matrices from the last scenehdl::update(),
+ * which drawing the scene does every frame, so it doesn't have to
+ * look at every object itself.
+ */
+int pickhdl::pick(scenehdl *scene, vec3f origin, vec3f direction)
+{
+	object = -1;
+	rigid = -1;
+	triangle = -1;
+	t = 1.0e30f;
+
+	scene->tree.raycast(origin, direction, t, [&](int i, float end) {
+		// Objects may have been taken out of the scene since the tree
+		// was last updated.
+		if (i >= (int)scene->objects.size() || scene->objects[i] == NULL)
+			return end;
+
+		// Objects that are scaled down to a point can't be hit.
+		objecthdl *o = scene->objects[i];
+		mat4f inverse;
+		if (!scene->is_shown(i) || !affine_inverse(o->world_matrix(), inverse))
+			return end;
+
+		packethdl packet;
+		packet.add(origin, direction, end);
+		packet.transform(inverse);
+		for (unsigned int j = 0; j < o->rigid.size(); j++)
+		{
+			meshhdl *mesh = o->rigid[j].mesh.get();
+			if (mesh == NULL || mesh->indices.size() < 3)
+				continue;
+
+			mesh->update_bvh();
+			mesh->bvh.intersect(packet, mesh->geometry, mesh->indices, j);
+		}
+
+		if (packet.object[0] >= 0)
+		{
+			object = i;
+			rigid = packet.object[0];
+			triangle = packet.triangle[0];
+			t = packet.t[0];
+		}
+		return packet.t[0];
+	});
+
+	if (object >= 0)
+		point = origin + t*direction;
+	return object;
+}
@@ -0,0 +1,41 @@
+/*
+ * pick.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+
+using namespace core;
+
+#ifndef pick_h
+#define pick_h
+
+struct scenehdl;
+
+/* This finds the object under the mouse. The ray goes through the
+ * tree of the scene to the objects whose boxes it reaches, nearest
+ * first, then it is moved into the object space of each one and
+ * tested against the triangles through the hierarchy that each of
+ * its meshes keeps, see meshhdl::update_bvh. Only the full detail
+ * triangles are tested, whatever level is drawn.
+ */
+struct pickhdl
+{
+	pickhdl();
+	~pickhdl();
+
+	// The nearest hit of the last pick(). 'object' and 'rigid' are -1
+	// if nothing was hit, and 'point' is in world space.
+	int object;
+	int rigid;
+	int triangle;
+	float t;
+	vec3f point;
+
+	int pick(scenehdl *scene, vec3f origin, vec3f direction);
+};
+
+#endif
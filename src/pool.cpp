@@ -0,0 +1,133 @@
+/*
+ * pool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "pool.h"
+#include <atomic>
+#include <memory>
+
+/* poolhdl
+ *
+ * Start 'threads'-1 workers. If 'threads' is zero, use
+ * one thread per hardware core.
+ */
+poolhdl::poolhdl(int threads)
+{
+	stopping = false;
+
+	if (threads <= 0)
+		threads = (int)thread::hardware_concurrency();
+
+	for (int i = 1; i < threads; i++)
+		workers.push_back(thread(&poolhdl::work, this));
+}
+
+poolhdl::~poolhdl()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	ready.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+int poolhdl::size()
+{
+	return (int)workers.size() + 1;
+}
+
+void poolhdl::work()
+{
+	while (true)
+	{
+		function<void()> job;
+		{
+			unique_lock<mutex> guard(lock);
+			while (!stopping && jobs.empty())
+				ready.wait(guard);
+
+			if (jobs.empty())
+				return;
+
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+/* This is shared between the caller of run() and the workers
+ * helping it. The workers may still hold a reference after
+ * run() returns, so it lives on the heap.
+ */
+struct loophdl
+{
+	loophdl(int count) : count(count), next(0), done(0) {}
+
+	int count;
+	atomic<int> next;
+	atomic<int> done;
+	mutex lock;
+	condition_variable finished;
+};
+
+static void run_loop(shared_ptr<loophdl> loop, const function<void(int)> *job)
+{
+	int i;
+	while ((i = loop->next++) < loop->count)
+	{
+		(*job)(i);
+		if (++loop->done == loop->count)
+		{
+			lock_guard<mutex> guard(loop->lock);
+			loop->finished.notify_all();
+		}
+	}
+}
+
+/* run
+ *
+ * Call job(i) for every i in [0, count) and wait for all of
+ * them to finish. The calls may happen in any order and on
+ * any thread.
+ */
+void poolhdl::run(int count, const function<void(int)> &job)
+{
+	if (count <= 0)
+		return;
+
+	if (count == 1 || workers.size() == 0)
+	{
+		for (int i = 0; i < count; i++)
+			job(i);
+		return;
+	}
+
+	shared_ptr<loophdl> loop(new loophdl(count));
+	{
+		lock_guard<mutex> guard(lock);
+		for (int i = 0; i < (int)workers.size() && i < count-1; i++)
+			jobs.push_back(bind(run_loop, loop, &job));
+	}
+	ready.notify_all();
+
+	run_loop(loop, &job);
+
+	unique_lock<mutex> guard(loop->lock);
+	while (loop->done < count)
+		loop->finished.wait(guard);
+}
+
+poolhdl &poolhdl::shared()
+{
+	static poolhdl pool;
+	return pool;
+}
@@ -0,0 +1,48 @@
+/*
+ * pool.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "standard.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+#ifndef pool_h
+#define pool_h
+
+/* A fixed set of worker threads that splits loops
+ * across the cores of the machine. The thread that
+ * calls run() works through the loop as well, so a
+ * pool with no workers just runs everything in place.
+ */
+struct poolhdl
+{
+	poolhdl(int threads = 0);
+	~poolhdl();
+
+	vector<thread> workers;
+	deque<function<void()> > jobs;
+	mutex lock;
+	condition_variable ready;
+	bool stopping;
+
+	// The number of threads that take part in run(), including the caller.
+	int size();
+
+	void run(int count, const function<void(int)> &job);
+
+	static poolhdl &shared();
+
+private:
+	void work();
+
+	poolhdl(const poolhdl &p);
+	poolhdl &operator=(const poolhdl &p);
+};
+
+#endif
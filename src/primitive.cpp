@@ -6,85 +6,120 @@
  */
 
 #include "primitive.h"
+#include <functional>
+#include <iomanip>
 
-/* boxhdl
+/* shared_mesh
+ *
+ * Get the mesh that the mesh cache has under 'key', or make one
+ * with 'generate' and share it under 'key' if there isn't one.
+ */
+static shared_ptr<meshhdl> shared_mesh(string key, const function<void(meshhdl&)> &generate)
+{
+	shared_ptr<meshhdl> result = meshhdl::find(key);
+	if (result == NULL)
+	{
+		result = make_shared<meshhdl>();
+		generate(*result);
+		result = meshhdl::share(key, result);
+	}
+	return result;
+}
+
+/* box_mesh
  *
  * Generate the geometry and indices required to make a box.
  */
+static void box_mesh(meshhdl &mesh, float width, float height, float depth)
+{
+	mesh.geometry.reserve(24);
+	mesh.indices.reserve(36);
+
+	mesh.geometry.push_back(vec8f(-width/2, -height/2, -depth/2, 0.0, 0.0, -1.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2, -depth/2, 0.0, 0.0, -1.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f( width/2,  height/2, -depth/2, 0.0, 0.0, -1.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2, -depth/2, 0.0, 0.0, -1.0, 1.0, 0.0));
+	mesh.indices.push_back(0);
+	mesh.indices.push_back(1);
+	mesh.indices.push_back(2);
+	mesh.indices.push_back(0);
+	mesh.indices.push_back(2);
+	mesh.indices.push_back(3);
+
+	mesh.geometry.push_back(vec8f(-width/2, -height/2,  depth/2, -1.0, 0.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f(-width/2, -height/2, -depth/2, -1.0, 0.0, 0.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2, -depth/2, -1.0, 0.0, 0.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2,  depth/2, -1.0, 0.0, 0.0, 1.0, 0.0));
+	mesh.indices.push_back(4);
+	mesh.indices.push_back(5);
+	mesh.indices.push_back(6);
+	mesh.indices.push_back(4);
+	mesh.indices.push_back(6);
+	mesh.indices.push_back(7);
+
+	mesh.geometry.push_back(vec8f(-width/2, -height/2, -depth/2, 0.0, -1.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2, -depth/2, 0.0, -1.0, 0.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2,  depth/2, 0.0, -1.0, 0.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2, -height/2,  depth/2, 0.0, -1.0, 0.0, 1.0, 0.0));
+	mesh.indices.push_back(10);
+	mesh.indices.push_back(9);
+	mesh.indices.push_back(8);
+	mesh.indices.push_back(11);
+	mesh.indices.push_back(10);
+	mesh.indices.push_back(8);
+
+	mesh.geometry.push_back(vec8f( width/2,  height/2,  depth/2, 0.0, 0.0, 1.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2,  depth/2, 0.0, 0.0, 1.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2, -height/2,  depth/2, 0.0, 0.0, 1.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2,  depth/2, 0.0, 0.0, 1.0, 1.0, 0.0));
+	mesh.indices.push_back(12);
+	mesh.indices.push_back(13);
+	mesh.indices.push_back(14);
+	mesh.indices.push_back(12);
+	mesh.indices.push_back(14);
+	mesh.indices.push_back(15);
+
+	mesh.geometry.push_back(vec8f( width/2,  height/2,  depth/2, 0.0, 1.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2,  depth/2, 0.0, 1.0, 0.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f(-width/2,  height/2, -depth/2, 0.0, 1.0, 0.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f( width/2,  height/2, -depth/2, 0.0, 1.0, 0.0, 1.0, 0.0));
+	mesh.indices.push_back(16);
+	mesh.indices.push_back(17);
+	mesh.indices.push_back(18);
+	mesh.indices.push_back(16);
+	mesh.indices.push_back(18);
+	mesh.indices.push_back(19);
+
+	mesh.geometry.push_back(vec8f( width/2,  height/2,  depth/2, 1.0, 0.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f( width/2,  height/2, -depth/2, 1.0, 0.0, 0.0, 0.0, 1.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2, -depth/2, 1.0, 0.0, 0.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f( width/2, -height/2,  depth/2, 1.0, 0.0, 0.0, 1.0, 0.0));
+	mesh.indices.push_back(20);
+	mesh.indices.push_back(21);
+	mesh.indices.push_back(22);
+	mesh.indices.push_back(20);
+	mesh.indices.push_back(22);
+	mesh.indices.push_back(23);
+
+	mesh.optimize();
+}
+
+/* boxhdl
+ *
+ * Make a box, sharing its mesh with every other box made
+ * with the same parameters.
+ */
 boxhdl::boxhdl(float width, float height, float depth)
 {
 	rigid.push_back(rigidhdl());
 
 	rigid[0].material = "default";
 
-	rigid[0].geometry.reserve(24);
-	rigid[0].indices.reserve(36);
-
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2, -depth/2, 0.0, 0.0, -1.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2, -depth/2, 0.0, 0.0, -1.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2, -depth/2, 0.0, 0.0, -1.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2, -depth/2, 0.0, 0.0, -1.0, 1.0, 0.0));
-	rigid[0].indices.push_back(0);
-	rigid[0].indices.push_back(1);
-	rigid[0].indices.push_back(2);
-	rigid[0].indices.push_back(0);
-	rigid[0].indices.push_back(2);
-	rigid[0].indices.push_back(3);
-
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2,  depth/2, -1.0, 0.0, 0.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2, -depth/2, -1.0, 0.0, 0.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2, -depth/2, -1.0, 0.0, 0.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2,  depth/2, -1.0, 0.0, 0.0, 1.0, 0.0));
-	rigid[0].indices.push_back(4);
-	rigid[0].indices.push_back(5);
-	rigid[0].indices.push_back(6);
-	rigid[0].indices.push_back(4);
-	rigid[0].indices.push_back(6);
-	rigid[0].indices.push_back(7);
-
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2, -depth/2, 0.0, -1.0, 0.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2, -depth/2, 0.0, -1.0, 0.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2,  depth/2, 0.0, -1.0, 0.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2,  depth/2, 0.0, -1.0, 0.0, 1.0, 0.0));
-	rigid[0].indices.push_back(10);
-	rigid[0].indices.push_back(9);
-	rigid[0].indices.push_back(8);
-	rigid[0].indices.push_back(11);
-	rigid[0].indices.push_back(10);
-	rigid[0].indices.push_back(8);
-
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2,  depth/2, 0.0, 0.0, 1.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2,  depth/2, 0.0, 0.0, 1.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2, -height/2,  depth/2, 0.0, 0.0, 1.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2,  depth/2, 0.0, 0.0, 1.0, 1.0, 0.0));
-	rigid[0].indices.push_back(12);
-	rigid[0].indices.push_back(13);
-	rigid[0].indices.push_back(14);
-	rigid[0].indices.push_back(12);
-	rigid[0].indices.push_back(14);
-	rigid[0].indices.push_back(15);
-
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2,  depth/2, 0.0, 1.0, 0.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2,  depth/2, 0.0, 1.0, 0.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f(-width/2,  height/2, -depth/2, 0.0, 1.0, 0.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2, -depth/2, 0.0, 1.0, 0.0, 1.0, 0.0));
-	rigid[0].indices.push_back(16);
-	rigid[0].indices.push_back(17);
-	rigid[0].indices.push_back(18);
-	rigid[0].indices.push_back(16);
-	rigid[0].indices.push_back(18);
-	rigid[0].indices.push_back(19);
-
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2,  depth/2, 1.0, 0.0, 0.0, 0.0, 0.0));
-	rigid[0].geometry.push_back(vec8f( width/2,  height/2, -depth/2, 1.0, 0.0, 0.0, 0.0, 1.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2, -depth/2, 1.0, 0.0, 0.0, 1.0, 1.0));
-	rigid[0].geometry.push_back(vec8f( width/2, -height/2,  depth/2, 1.0, 0.0, 0.0, 1.0, 0.0));
-	rigid[0].indices.push_back(20);
-	rigid[0].indices.push_back(21);
-	rigid[0].indices.push_back(22);
-	rigid[0].indices.push_back(20);
-	rigid[0].indices.push_back(22);
-	rigid[0].indices.push_back(23);
+	ostringstream key;
+	key << setprecision(9) << "box " << width << " " << height << " " << depth;
+	rigid[0].mesh = shared_mesh(key.str(), [=](meshhdl &mesh) {
+		box_mesh(mesh, width, height, depth);
+	});
 
 	bound = vec6f(-width/2.0, width/2.0, -height/2.0, height/2.0, -depth/2.0, depth/2.0);
 
@@ -96,55 +131,71 @@ boxhdl::~boxhdl()
 
 }
 
-/* spherehdl
+/* sphere_mesh
  *
  * Generate the geometry and indices required to make a sphere.
  */
-spherehdl::spherehdl(float radius, int levels, int slices)
+static void sphere_mesh(meshhdl &mesh, float radius, int levels, int slices)
 {
-	rigid.push_back(rigidhdl());
-
-	rigid[0].material = "default";
-
-	rigid[0].geometry.reserve(2 + (levels-1)*slices);
-	rigid[0].geometry.push_back(vec8f(0.0, 0.0, radius, 0.0, 0.0, 1.0, 0.0, 0.0));
+	mesh.geometry.reserve(2 + (levels-1)*slices);
+	mesh.geometry.push_back(vec8f(0.0, 0.0, radius, 0.0, 0.0, 1.0, 0.0, 0.0));
 	for (int i = 1; i < levels; i++)
 		for (int j = 0; j < slices; j++)
 		{
 			vec3f dir(sin(m_pi*(float)i/(float)levels)*cos(2.0*m_pi*(float)j/(float)slices),
 					  sin(m_pi*(float)i/(float)levels)*sin(2.0*m_pi*(float)j/(float)slices),
 					  cos(m_pi*(float)i/(float)levels));
-			rigid[0].geometry.push_back(vec8f(radius*dir[0], radius*dir[1], radius*dir[2],
+			mesh.geometry.push_back(vec8f(radius*dir[0], radius*dir[1], radius*dir[2],
 									 dir[0], dir[1], dir[2], (float)j/(float)(slices-1), (float)i/(float)levels));
 		}
-	rigid[0].geometry.push_back(vec8f(0.0, 0.0, -radius, 0.0, 0.0, -1.0, 1.0, 1.0));
+	mesh.geometry.push_back(vec8f(0.0, 0.0, -radius, 0.0, 0.0, -1.0, 1.0, 1.0));
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + (i+1)%slices);
-		rigid[0].indices.push_back(1 + i);
-		rigid[0].indices.push_back(0);
+		mesh.indices.push_back(1 + (i+1)%slices);
+		mesh.indices.push_back(1 + i);
+		mesh.indices.push_back(0);
 	}
 
 	for (int i = 0; i < levels-2; i++)
 		for (int j = 0; j < slices; j++)
 		{
-			rigid[0].indices.push_back(1 + i*slices + j);
-			rigid[0].indices.push_back(1 + i*slices + (j+1)%slices);
-			rigid[0].indices.push_back(1 + (i+1)*slices + j);
+			mesh.indices.push_back(1 + i*slices + j);
+			mesh.indices.push_back(1 + i*slices + (j+1)%slices);
+			mesh.indices.push_back(1 + (i+1)*slices + j);
 
-			rigid[0].indices.push_back(1 + (i+1)*slices + j);
-			rigid[0].indices.push_back(1 + i*slices + (j+1)%slices);
-			rigid[0].indices.push_back(1 + (i+1)*slices + (j+1)%slices);
+			mesh.indices.push_back(1 + (i+1)*slices + j);
+			mesh.indices.push_back(1 + i*slices + (j+1)%slices);
+			mesh.indices.push_back(1 + (i+1)*slices + (j+1)%slices);
 		}
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + (levels-1)*slices);
-		rigid[0].indices.push_back(1 + (levels-2)*slices + i);
-		rigid[0].indices.push_back(1 + (levels-2)*slices + (i+1)%slices);
+		mesh.indices.push_back(1 + (levels-1)*slices);
+		mesh.indices.push_back(1 + (levels-2)*slices + i);
+		mesh.indices.push_back(1 + (levels-2)*slices + (i+1)%slices);
 	}
 
+	mesh.optimize();
+}
+
+/* spherehdl
+ *
+ * Make a sphere, sharing its mesh with every other sphere made
+ * with the same parameters.
+ */
+spherehdl::spherehdl(float radius, int levels, int slices)
+{
+	rigid.push_back(rigidhdl());
+
+	rigid[0].material = "default";
+
+	ostringstream key;
+	key << setprecision(9) << "sphere " << radius << " " << levels << " " << slices;
+	rigid[0].mesh = shared_mesh(key.str(), [=](meshhdl &mesh) {
+		sphere_mesh(mesh, radius, levels, slices);
+	});
+
 	bound = vec6f(-radius, radius, -radius, radius, -radius, radius);
 
 	material.insert(pair<string, materialhdl*>("default", new whitehdl()));
@@ -155,25 +206,21 @@ spherehdl::~spherehdl()
 
 }
 
-/* cylinderhdl
+/* cylinder_mesh
  *
  * Generate the geometry and indices required to make a cylinder.
  */
-cylinderhdl::cylinderhdl(float radius, float height, int slices)
+static void cylinder_mesh(meshhdl &mesh, float radius, float height, int slices)
 {
-	rigid.push_back(rigidhdl());
-
-	rigid[0].material = "default";
-
-	rigid[0].geometry.push_back(vec8f(0.0, -height/2.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f(0.0, -height/2.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0));
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 -height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 0.0, -1.0, 0.0, 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 -height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 cos(2*m_pi*(float)i/(float)slices),
@@ -181,7 +228,7 @@ cylinderhdl::cylinderhdl(float radius, float height, int slices)
 								 sin(2*m_pi*(float)i/(float)slices), 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 cos(2*m_pi*(float)i/(float)slices),
@@ -189,38 +236,58 @@ cylinderhdl::cylinderhdl(float radius, float height, int slices)
 								 sin(2*m_pi*(float)i/(float)slices), 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 0.0, 1.0, 0.0, 0.0, 0.0));
 
-	rigid[0].geometry.push_back(vec8f(0.0, height/2.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f(0.0, height/2.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + (i+1)%slices);
-		rigid[0].indices.push_back(1 + i);
-		rigid[0].indices.push_back(0);
+		mesh.indices.push_back(1 + (i+1)%slices);
+		mesh.indices.push_back(1 + i);
+		mesh.indices.push_back(0);
 	}
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + slices + i);
-		rigid[0].indices.push_back(1 + slices + (i+1)%slices);
-		rigid[0].indices.push_back(1 + 2*slices + i);
+		mesh.indices.push_back(1 + slices + i);
+		mesh.indices.push_back(1 + slices + (i+1)%slices);
+		mesh.indices.push_back(1 + 2*slices + i);
 
-		rigid[0].indices.push_back(1 + 2*slices + i);
-		rigid[0].indices.push_back(1 + slices + (i+1)%slices);
-		rigid[0].indices.push_back(1 + 2*slices + (i+1)%slices);
+		mesh.indices.push_back(1 + 2*slices + i);
+		mesh.indices.push_back(1 + slices + (i+1)%slices);
+		mesh.indices.push_back(1 + 2*slices + (i+1)%slices);
 	}
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + 3*slices + i);
-		rigid[0].indices.push_back(1 + 3*slices + (i+1)%slices);
-		rigid[0].indices.push_back(1 + 4*slices);
+		mesh.indices.push_back(1 + 3*slices + i);
+		mesh.indices.push_back(1 + 3*slices + (i+1)%slices);
+		mesh.indices.push_back(1 + 4*slices);
 	}
 
+	mesh.optimize();
+}
+
+/* cylinderhdl
+ *
+ * Make a cylinder, sharing its mesh with every other cylinder made
+ * with the same parameters.
+ */
+cylinderhdl::cylinderhdl(float radius, float height, int slices)
+{
+	rigid.push_back(rigidhdl());
+
+	rigid[0].material = "default";
+
+	ostringstream key;
+	key << setprecision(9) << "cylinder " << radius << " " << height << " " << slices;
+	rigid[0].mesh = shared_mesh(key.str(), [=](meshhdl &mesh) {
+		cylinder_mesh(mesh, radius, height, slices);
+	});
+
 	bound = vec6f(-radius, radius, -height/2.0, height/2.0, -radius, radius);
 
 	material.insert(pair<string, materialhdl*>("default", new whitehdl()));
@@ -231,28 +298,24 @@ cylinderhdl::~cylinderhdl()
 
 }
 
-/* pyramidhdl
+/* pyramid_mesh
  *
  * Generate the geometry and indices required to make a pyramid.
  */
-pyramidhdl::pyramidhdl(float radius, float height, int slices)
+static void pyramid_mesh(meshhdl &mesh, float radius, float height, int slices)
 {
-	rigid.push_back(rigidhdl());
-
-	rigid[0].material = "default";
-
 	float nheight = sqrt(1.0f/(1.0f + (height*height)/(radius*radius)));
 	float nlength = height*nheight/radius;
 
-	rigid[0].geometry.push_back(vec8f(0.0, -height/2.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0));
+	mesh.geometry.push_back(vec8f(0.0, -height/2.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0));
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 -height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 0.0, -1.0, 0.0, 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
+		mesh.geometry.push_back(vec8f(radius*cos(2*m_pi*(float)i/(float)slices),
 								 -height/2.0,
 								 radius*sin(2*m_pi*(float)i/(float)slices),
 								 nlength*cos(2*m_pi*(float)i/(float)slices),
@@ -260,26 +323,46 @@ pyramidhdl::pyramidhdl(float radius, float height, int slices)
 								 nlength*sin(2*m_pi*(float)i/(float)slices), 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
-		rigid[0].geometry.push_back(vec8f(0.0, height/2.0, 0.0,
+		mesh.geometry.push_back(vec8f(0.0, height/2.0, 0.0,
 								 nlength*cos(2*m_pi*((float)i + 0.5)/(float)slices),
 								 nheight,
 								 nlength*sin(2*m_pi*((float)i + 0.5)/(float)slices), 0.0, 0.0));
-	//rigid[0].geometry.push_back(vec8f(0.0, height/2.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0));
+	//mesh.geometry.push_back(vec8f(0.0, height/2.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0));
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + (i+1)%slices);
-		rigid[0].indices.push_back(1 + i);
-		rigid[0].indices.push_back(0);
+		mesh.indices.push_back(1 + (i+1)%slices);
+		mesh.indices.push_back(1 + i);
+		mesh.indices.push_back(0);
 	}
 
 	for (int i = 0; i < slices; i++)
 	{
-		rigid[0].indices.push_back(1 + slices + i);
-		rigid[0].indices.push_back(1 + slices + (i+1)%slices);
-		rigid[0].indices.push_back(1 + 2*slices + i);
+		mesh.indices.push_back(1 + slices + i);
+		mesh.indices.push_back(1 + slices + (i+1)%slices);
+		mesh.indices.push_back(1 + 2*slices + i);
 	}
 
+	mesh.optimize();
+}
+
+/* pyramidhdl
+ *
+ * Make a pyramid, sharing its mesh with every other pyramid made
+ * with the same parameters.
+ */
+pyramidhdl::pyramidhdl(float radius, float height, int slices)
+{
+	rigid.push_back(rigidhdl());
+
+	rigid[0].material = "default";
+
+	ostringstream key;
+	key << setprecision(9) << "pyramid " << radius << " " << height << " " << slices;
+	rigid[0].mesh = shared_mesh(key.str(), [=](meshhdl &mesh) {
+		pyramid_mesh(mesh, radius, height, slices);
+	});
+
 	bound = vec6f(-radius, radius, -height/2.0, height/2.0, -radius, radius);
 
 	material.insert(pair<string, materialhdl*>("default", new whitehdl()));
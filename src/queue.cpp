@@ -0,0 +1,217 @@
+/*
+ * queue.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "queue.h"
+#include "object.h"
+#include "material.h"
+
+bool itemhdl::operator<(const itemhdl &i) const
+{
+	return key < i.key;
+}
+
+queuehdl::queuehdl()
+{
+	instance_buffer = 0;
+	program_changes = 0;
+	material_changes = 0;
+	draw_calls = 0;
+}
+
+queuehdl::~queuehdl()
+{
+	release();
+}
+
+/* clear
+ *
+ * Empty the queue for the next frame.
+ */
+void queuehdl::clear()
+{
+	items.clear();
+	transforms.clear();
+	programs.clear();
+	materials.clear();
+	material_ids.clear();
+	meshes.clear();
+	instances.clear();
+}
+
+/* push_transform
+ *
+ * Add a modelview matrix for the items of one object to share,
+ * returning its index.
+ */
+int queuehdl::push_transform(const mat4f &modelview)
+{
+	transforms.push_back(modelview);
+	return (int)transforms.size()-1;
+}
+
+/* push
+ *
+ * Add a rigid body to be drawn with the given material and
+ * transform. 'depth' is the distance in front of the camera.
+ */
+void queuehdl::push(rigidhdl *rigid, materialhdl *material, int transform, float depth)
+{
+	// Every object has its own copy of its materials, so look for
+	// one that was already pushed and looks the same.
+	map<materialhdl*, int>::iterator m = materials.find(material);
+	if (m == materials.end())
+	{
+		int id = 0;
+		while (id < (int)material_ids.size() && !material_ids[id]->equals(material))
+			id++;
+		if (id == (int)material_ids.size())
+			material_ids.push_back(material);
+		m = materials.insert(pair<materialhdl*, int>(material, id)).first;
+	}
+
+	const programhdl *uniforms = material->program_uniforms();
+	const void *source = (uniforms != NULL ? (const void*)uniforms : (const void*)material_ids[m->second]);
+	map<const void*, int>::iterator p = programs.insert(pair<const void*, int>(source, (int)programs.size())).first;
+	unsigned long long program = (unsigned long long)(p->second & 0xFF);
+
+	map<unsigned long long, int>::iterator h = meshes.insert(pair<unsigned long long, int>(rigid->mesh->hash(), (int)meshes.size())).first;
+
+	// Positive floats sort the same way as their bits do, and the
+	// top 24 bits keep 15 bits of mantissa.
+	unsigned int bits = 0;
+	if (depth > 0.0f)
+		memcpy(&bits, &depth, sizeof(float));
+
+	itemhdl item;
+	item.key = (program << 56) | ((unsigned long long)(m->second & 0xFFFF) << 40) | ((unsigned long long)(h->second & 0xFFFF) << 24) | (unsigned long long)(bits >> 8);
+	item.material_id = m->second;
+	item.mesh_id = h->second;
+	item.transform = transform;
+	item.rigid = rigid;
+	item.material = material;
+	items.push_back(item);
+}
+
+/* sort
+ *
+ * Order the items by their keys. Items with equal keys keep the
+ * order they were pushed in.
+ */
+void queuehdl::sort()
+{
+	stable_sort(items.begin(), items.end());
+}
+
+/* submit
+ *
+ * Draw every item in order. Runs of items with the same material,
+ * mesh, and level of detail are drawn with one instanced draw call
+ * if their program supports it. A material's program and textures
+ * are only bound when the program changes, its uniforms are only
+ * sent when the material changes, and the modelview matrix is
+ * only loaded when the object changes. This leaves the modelview
+ * matrix of the last object loaded.
+ */
+void queuehdl::submit()
+{
+	program_changes = 0;
+	material_changes = 0;
+	draw_calls = 0;
+
+	// Split the items into runs, and gather the modelview matrices
+	// of the runs that will be instanced.
+	vector<int> runs;
+	instances.clear();
+	instances.reserve(items.size()*16);
+	for (unsigned int i = 0; i < items.size(); )
+	{
+		unsigned int j = i+1;
+		while (j < items.size() && items[j].material_id == items[i].material_id && items[j].mesh_id == items[i].mesh_id && items[j].rigid->lod == items[i].rigid->lod)
+			j++;
+
+		const programhdl *uniforms = items[i].material->program_uniforms();
+		if (j - i > 1 && (uniforms == NULL || uniforms->location[uniform_instanced] == -1))
+			j = i+1;
+
+		if (j - i > 1)
+			for (unsigned int k = i; k < j; k++)
+			{
+				const mat4f &m = transforms[items[k].transform];
+				for (int c = 0; c < 4; c++)
+					for (int r = 0; r < 4; r++)
+						instances.push_back(m[r][c]);
+			}
+
+		runs.push_back(j - i);
+		i = j;
+	}
+
+	if (instances.size() > 0)
+	{
+		if (instance_buffer == 0)
+			glGenBuffers(1, &instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, instances.size()*sizeof(float), instances.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	materialhdl *material = NULL;
+	int material_id = -1;
+	GLuint program = 0;
+	int transform = -1;
+	size_t offset = 0;
+	for (unsigned int r = 0, i = 0; r < runs.size(); i += runs[r++])
+	{
+		if (items[i].material_id != material_id)
+		{
+			// A program of 0 means either that the material doesn't
+			// use one or that it hasn't been compiled yet.
+			const programhdl *uniforms = items[i].material->program_uniforms();
+			GLuint next = (uniforms != NULL ? uniforms->program : 0);
+			if (material == NULL || next == 0 || next != program)
+			{
+				items[i].material->bind();
+				uniforms = items[i].material->program_uniforms();
+				program = (uniforms != NULL ? uniforms->program : 0);
+				program_changes++;
+			}
+
+			items[i].material->set_uniforms();
+			material = items[i].material;
+			material_id = items[i].material_id;
+			material_changes++;
+		}
+
+		if (runs[r] > 1)
+		{
+			items[i].rigid->draw(material->program_uniforms(), runs[r], instance_buffer, offset);
+			offset += runs[r]*16*sizeof(float);
+		}
+		else
+		{
+			if (items[i].transform != transform)
+			{
+				transform = items[i].transform;
+				glLoadTransposeMatrixf((const float*)transforms[transform].data);
+			}
+
+			items[i].rigid->draw(material->program_uniforms());
+		}
+		draw_calls++;
+	}
+}
+
+/* release
+ *
+ * Delete the instance buffer.
+ */
+void queuehdl::release()
+{
+	if (instance_buffer != 0)
+		glDeleteBuffers(1, &instance_buffer);
+	instance_buffer = 0;
+}
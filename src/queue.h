@@ -0,0 +1,85 @@
+/*
+ * queue.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include "opengl.h"
+
+using namespace core;
+
+#ifndef queue_h
+#define queue_h
+
+struct rigidhdl;
+struct materialhdl;
+
+/* One rigid body waiting to be drawn. The key packs, from the
+ * most to the least significant bits, the program (8 bits), the
+ * material (16 bits), the mesh (16 bits), and the distance from
+ * the camera (24 bits). Materials that look the same share a
+ * number, and so do identical meshes. Materials without a program
+ * of their own are each numbered as a program of their own. Sorting by the key binds
+ * each program once, puts copies of the same mesh next to each
+ * other so that they can be instanced, and draws each group of
+ * opaque geometry front to back.
+ */
+struct itemhdl
+{
+	unsigned long long key;
+	int material_id;
+	int mesh_id;
+	int transform;
+	rigidhdl *rigid;
+	materialhdl *material;
+
+	bool operator<(const itemhdl &i) const;
+};
+
+/* This collects everything that is drawn in a frame so that it
+ * can be sorted once and then drawn with as few changes to the
+ * OpenGL state and as few draw calls as possible.
+ */
+struct queuehdl
+{
+	queuehdl();
+	~queuehdl();
+
+	vector<itemhdl> items;
+
+	// The modelview matrices of the objects, in row major order.
+	vector<mat4f> transforms;
+
+	// Programs, materials and meshes are numbered in the order
+	// that they are first pushed. Programs are found by their
+	// uniforms, or by the first material of the same look for the
+	// materials that have none. Each material number is listed
+	// with the first material that was given it.
+	map<const void*, int> programs;
+	map<materialhdl*, int> materials;
+	vector<materialhdl*> material_ids;
+	map<unsigned long long, int> meshes;
+
+	// The modelview matrices of every instanced draw, in column
+	// major order.
+	vector<float> instances;
+	GLuint instance_buffer;
+
+	// How many times the last submit() had to bind a program, send
+	// the uniforms of a material, or make a draw call.
+	int program_changes;
+	int material_changes;
+	int draw_calls;
+
+	void clear();
+	int push_transform(const mat4f &modelview);
+	void push(rigidhdl *rigid, materialhdl *material, int transform, float depth);
+	void sort();
+	void submit();
+	void release();
+};
+
+#endif
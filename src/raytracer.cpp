@@ -0,0 +1,154 @@
+/*
+ * raytracer.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "raytracer.h"
+#include "canvas.h"
+#include "scene.h"
+#include "object.h"
+#include "pool.h"
+
+raytracerhdl::raytracerhdl()
+{
+	rays = 0;
+}
+
+raytracerhdl::~raytracerhdl()
+{
+}
+
+/* draw
+ *
+ * Trace the scene into the canvas's image. Pixels that no ray hits
+ * are left alone.
+ */
+void raytracerhdl::draw(scenehdl *scene, canvashdl &canvas)
+{
+	canvas.begin(scene);
+	canvas.draws.clear();
+	inverses.clear();
+
+	vector<vec6f> bounds;
+	bool textured = false;
+	for (unsigned int i = 0; i < scene->objects.size(); i++)
+	{
+		objecthdl *object = scene->objects[i];
+		if (object == NULL || !scene->is_shown(i))
+			continue;
+
+		// Objects that are scaled down to a point can't be hit.
+		mat4f modelview = canvas.view*object->world_matrix();
+		mat4f inverse;
+		if (!affine_inverse(modelview, inverse))
+			continue;
+
+		for (unsigned int j = 0; j < object->rigid.size(); j++)
+		{
+			rigidhdl &rigid = object->rigid[j];
+			map<string, materialhdl*>::iterator material = object->material.find(rigid.material);
+
+			canvasdrawhdl d;
+			d.set_material(material != object->material.end() ? material->second : NULL);
+			d.mesh = rigid.mesh.get();
+			d.indices = &d.mesh->indices;
+			if (d.shading == canvashdl::shade_none || d.indices->size() < 3)
+				continue;
+
+			d.modelview = modelview;
+			d.first_vertex = 0;
+			d.first_triangle = 0;
+			d.mesh->update_bvh();
+			textured = textured || d.shading == canvashdl::shade_texture;
+
+			bounds.push_back(transform_bound(modelview, d.mesh->bvh.bound()));
+			inverses.push_back(inverse);
+			canvas.draws.push_back(d);
+		}
+	}
+
+	if (textured)
+		canvas.load_texture();
+
+	scene_bvh.build(bounds);
+
+	int tiles_wide = (canvas.width + tile_size - 1)/tile_size;
+	int tiles_high = (canvas.height + tile_size - 1)/tile_size;
+	poolhdl::shared().run(tiles_wide*tiles_high, [this, &canvas](int i) {
+		trace(canvas, i);
+	});
+
+	rays = (long long)canvas.width*(long long)canvas.height;
+}
+
+/* trace
+ *
+ * Trace and shade the primary rays of one tile. A ray runs from the
+ * near plane to the far plane with 't' going from 0 to 1, so that it
+ * finds the same surfaces that clipping would leave.
+ */
+void raytracerhdl::trace(canvashdl &canvas, int tile)
+{
+	int tiles_wide = (canvas.width + tile_size - 1)/tile_size;
+	int left = (tile%tiles_wide)*tile_size;
+	int top = (tile/tiles_wide)*tile_size;
+	int right = min(left + tile_size, canvas.width);
+	int bottom = min(top + tile_size, canvas.height);
+
+	for (int y0 = top; y0 < bottom; y0 += packet_size)
+		for (int x0 = left; x0 < right; x0 += packet_size)
+		{
+			packethdl packet;
+			int px[packethdl::size], py[packethdl::size];
+			for (int y = y0; y < min(y0 + packet_size, bottom); y++)
+				for (int x = x0; x < min(x0 + packet_size, right); x++)
+				{
+					float nx = ((float)x + 0.5f)/(float)canvas.width*2.0f - 1.0f;
+					float ny = 1.0f - ((float)y + 0.5f)/(float)canvas.height*2.0f;
+					vec3f near = unproject(canvas.projection, nx, ny, -1.0f);
+					vec3f far = unproject(canvas.projection, nx, ny, 1.0f);
+					px[packet.count] = x;
+					py[packet.count] = y;
+					packet.add(near, far - near, 1.0f);
+				}
+			packet.update_inverse();
+
+			scene_bvh.traverse(packet, [&](int d) {
+				const canvasdrawhdl &draw = canvas.draws[d];
+				packethdl local = packet;
+				local.transform(inverses[d]);
+				draw.mesh->bvh.intersect(local, draw.mesh->geometry, *draw.indices, d);
+				for (int i = 0; i < packet.count; i++)
+					if (local.t[i] < packet.t[i])
+					{
+						packet.t[i] = local.t[i];
+						packet.object[i] = local.object[i];
+						packet.triangle[i] = local.triangle[i];
+						packet.u[i] = local.u[i];
+						packet.v[i] = local.v[i];
+					}
+			});
+
+			for (int i = 0; i < packet.count; i++)
+			{
+				if (packet.object[i] < 0)
+					continue;
+
+				const canvasdrawhdl &draw = canvas.draws[packet.object[i]];
+				const int *index = &(*draw.indices)[packet.triangle[i]*3];
+				canvasvertexhdl v[3];
+				memset(v, 0, sizeof(v));
+				for (int k = 0; k < 3; k++)
+					canvas.shade_vertex(draw, draw.mesh->geometry[index[k]], v[k]);
+
+				float l[3] = {1.0f - packet.u[i] - packet.v[i], packet.u[i], packet.v[i]};
+				float varying[8];
+				for (int j = 0; j < 8; j++)
+					varying[j] = v[0].varying[j]*l[0] + v[1].varying[j]*l[1] + v[2].varying[j]*l[2];
+
+				canvashdl::store(&canvas.color[(py[i]*canvas.stride + px[i])*4], canvas.shade_fragment(draw, varying));
+			}
+		}
+}
@@ -0,0 +1,59 @@
+/*
+ * raytracer.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include "bvh.h"
+
+using namespace core;
+
+#ifndef raytracer_h
+#define raytracer_h
+
+struct scenehdl;
+struct canvashdl;
+
+/* A ray tracer that renders reference images of a scene on the CPU.
+ * It draws everything at full detail and shades with the vertex and
+ * fragment stages of canvashdl, so it lights things the same way as
+ * the shaders in res/, but finds the visible surfaces exactly instead
+ * of rasterizing.
+ *
+ * Every rigid body is found through two levels of bounding volume
+ * hierarchies: one over the rigid bodies in eye space, rebuilt every
+ * frame, and the one that each mesh keeps over its own triangles.
+ * Rays go into a mesh's object space to search its hierarchy. The
+ * image is split into tiles that are traced by the thread pool, and
+ * the primary rays of each 4 by 4 block of pixels are traced as one
+ * packet.
+ */
+struct raytracerhdl
+{
+	raytracerhdl();
+	~raytracerhdl();
+
+	enum
+	{
+		tile_size = 32,
+		packet_size = 4
+	};
+
+	// The rigid bodies in eye space, and the eye to object space
+	// transforms of the draws of the canvas.
+	bvhhdl scene_bvh;
+	vector<mat4f> inverses;
+
+	// How many rays the last draw() traced.
+	long long rays;
+
+	void draw(scenehdl *scene, canvashdl &canvas);
+
+private:
+	void trace(canvashdl &canvas, int tile);
+};
+
+#endif
@@ -20,10 +20,17 @@ scenehdl::scenehdl()
 	render_normals = none;
 	render_lights = false;
 	render_cameras = false;
+	culled = 0;
+	shown = 0;
+	light_buffer = 0;
 }
 
 scenehdl::~scenehdl()
 {
+	for (unsigned int i = 0; i < loading.size(); i++)
+		delete loading[i].result.get();
+	loading.clear();
+
 	for (unsigned int i = 0; i < objects.size(); i++)
 		delete objects[i];
 	objects.clear();
@@ -35,6 +42,10 @@ scenehdl::~scenehdl()
 	for (unsigned int i = 0; i < lights.size(); i++)
 		delete lights[i];
 	lights.clear();
+
+	if (light_buffer != 0)
+		glDeleteBuffers(1, &light_buffer);
+	light_buffer = 0;
 }
 
 /* draw
@@ -46,38 +57,193 @@ void scenehdl::draw()
 {
     //TODO: Do i need to clear uniforms here?
 
+	update();
+
+	mat4f view = identity<float, 4, 4>();
+	mat4f projection = identity<float, 4, 4>();
 	if (active_camera_valid())
+	{
 		cameras[active_camera]->view();
+		view = cameras[active_camera]->view_matrix;
+		projection = cameras[active_camera]->projection_matrix;
+	}
+	mat4f view_projection = projection*view;
+
+	for (unsigned int i = 0; i < lights.size(); i++)
+		lights[i]->update(view);
+
+	upload_lights();
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	queue.clear();
+	vector<int> shown_objects = visible(view_projection);
+	for (unsigned int k = 0; k < shown_objects.size(); k++)
+		objects[shown_objects[k]]->enqueue(queue, view, projection, viewport[3]);
+
+	queue.sort();
+	queue.submit();
+	glLoadTransposeMatrixf((float*)view.data);
+
+	for (unsigned int k = 0; k < shown_objects.size(); k++)
+	{
+		int i = shown_objects[k];
+		if (render_normals == vertex || render_normals == face)
+			objects[i]->draw_normals(render_normals == face);
+
+		bool is_loading = false;
+		for (unsigned int j = 0; j < loading.size() && !is_loading; j++)
+			if (loading[j].placeholder == objects[i])
+				is_loading = true;
+
+		if (i == active_object || is_loading)
+			objects[i]->draw_bound();
+	}
+}
+
+/* upload_lights
+ *
+ * Gather the lights, which must already be updated for this
+ * frame, into the uniform buffer that every program reads its
+ * lights block from.
+ */
+void scenehdl::upload_lights()
+{
+	lightblockhdl block;
+	memset(&block, 0, sizeof(block));
+	for (unsigned int i = 0; i < lights.size(); i++)
+		if (lights[i] != NULL)
+			lights[i]->apply(block);
+
+	if (light_buffer == 0)
+		glGenBuffers(1, &light_buffer);
 
+	glBindBuffer(GL_UNIFORM_BUFFER, light_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, light_binding, light_buffer);
+}
+
+/* update
+ *
+ * Bring the world matrices of the scene graph and the tree up to
+ * date with the objects. Every object is checked, but that is cheap
+ * for the ones that haven't moved, and the ones that have only touch
+ * O(log n) nodes of the tree. Leaves of objects that have left the
+ * scene are removed, and whether each object is the model of a
+ * light or a camera is found again. Call this after changing the
+ * objects and before is_shown(), visible(), or any query of the
+ * tree.
+ */
+void scenehdl::update()
+{
+	vector<objecthdl*> light_models, camera_models;
 	for (unsigned int i = 0; i < lights.size(); i++)
-		lights[i]->update();
+		if (lights[i] != NULL && lights[i]->model != NULL)
+			light_models.push_back(lights[i]->model);
+	for (unsigned int i = 0; i < cameras.size(); i++)
+		if (cameras[i] != NULL && cameras[i]->model != NULL)
+			camera_models.push_back(cameras[i]->model);
+	sort(light_models.begin(), light_models.end());
+	sort(camera_models.begin(), camera_models.end());
 
+	// The world matrices go down the scene graph from the roots, so
+	// they are all up to date before any of the proxies are moved.
 	for (unsigned int i = 0; i < objects.size(); i++)
-		if (objects[i] != NULL)
-		{
-			bool is_light = false;
-			bool is_camera = false;
-			for (unsigned int j = 0; j < lights.size() && !is_light; j++)
-				if (lights[j] != NULL && lights[j]->model == objects[i])
-					is_light = true;
+		if (objects[i] != NULL && objects[i]->parent == NULL)
+			objects[i]->update();
 
-			for (unsigned int j = 0; j < cameras.size() && !is_camera; j++)
-				if (cameras[j] != NULL && cameras[j]->model == objects[i])
-					is_camera = true;
+	int count = 0;
+	shown = 0;
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		objecthdl *object = objects[i];
+		if (object == NULL)
+			continue;
 
-			if ((!is_light && !is_camera) || (is_light && render_lights) || (is_camera && render_cameras && (!active_camera_valid() || objects[i] != cameras[active_camera]->model)))
-			{
-				objects[i]->draw(lights);
+		object->is_light = binary_search(light_models.begin(), light_models.end(), object);
+		object->is_camera = binary_search(camera_models.begin(), camera_models.end(), object);
+
+		// The leaf may have been removed and reused since this object
+		// was last in the scene.
+		if (object->proxy >= (int)owners.size() || (object->proxy >= 0 && owners[object->proxy] != object))
+			object->proxy = -1;
+
+		object->update_proxy(tree, i);
+		if ((int)owners.size() < (int)tree.nodes.size())
+			owners.resize(tree.nodes.size(), NULL);
+		owners[object->proxy] = object;
 
-				if (render_normals == vertex || render_normals == face)
-					objects[i]->draw_normals(render_normals == face);
+		count++;
+		if (is_shown(i))
+			shown++;
+	}
 
-				if ((int)i == active_object)
-					objects[i]->draw_bound();
+	// Some objects were taken out of the scene. A leaf is still in use
+	// if its item is the object that owns it and that object still
+	// points back at it.
+	if (tree.leaves > count)
+		for (unsigned int i = 0; i < tree.nodes.size(); i++)
+		{
+			const aabbnodehdl &node = tree.nodes[i];
+			if (node.height != 0)
+				continue;
+
+			bool used = node.item < (int)objects.size() && objects[node.item] != NULL && objects[node.item] == owners[i] && owners[i]->proxy == (int)i;
+			if (!used)
+			{
+				tree.remove(i);
+				owners[i] = NULL;
 			}
 		}
 }
 
+/* visible
+ *
+ * List the objects that are shown and at least partly in the view
+ * frustum, in the order that they are in 'objects', and count the
+ * ones that are shown but outside in 'culled'. The tree rules out
+ * whole groups of objects at once, and objects whose fattened box
+ * is entirely inside don't need to be checked on their own. Call
+ * update() first.
+ */
+vector<int> scenehdl::visible(const mat4f &view_projection)
+{
+	vector<int> result;
+	if (active_camera_valid())
+	{
+		tree.query(view_projection, [&](int i, bool inside) {
+			if (is_shown(i) && (inside || objects[i]->in_frustum(view_projection)))
+				result.push_back(i);
+		});
+		sort(result.begin(), result.end());
+	}
+	else
+	{
+		for (unsigned int i = 0; i < objects.size(); i++)
+			if (objects[i] != NULL && is_shown(i))
+				result.push_back(i);
+	}
+
+	culled = shown - (int)result.size();
+	return result;
+}
+
+/* is_shown
+ *
+ * Check whether the object at 'i' is drawn at all. The models of
+ * the lights and cameras are only drawn when they are turned on,
+ * and never the model of the camera that is being looked through.
+ * This doesn't include frustum culling, and it goes by the roles
+ * that update() last found.
+ */
+bool scenehdl::is_shown(int i)
+{
+	objecthdl *object = objects[i];
+	return ((!object->is_light && !object->is_camera) || (object->is_light && render_lights) || (object->is_camera && render_cameras && (!active_camera_valid() || object != cameras[active_camera]->model)));
+}
+
 bool scenehdl::active_camera_valid()
 {
 	return (active_camera >= 0 && active_camera < (int)cameras.size() && cameras[active_camera] != NULL);
@@ -87,3 +253,75 @@ bool scenehdl::active_object_valid()
 {
 	return (active_object >= 0 && active_object < (int)objects.size() && objects[active_object] != NULL);
 }
+
+/* load
+ *
+ * Start loading the model located at 'filename' on a worker thread.
+ * A placeholder object with a unit bounding box takes its place in
+ * the scene until update_loading() finds that it is done, so it can
+ * be moved around while it loads.
+ */
+void scenehdl::load(string filename)
+{
+	objecthdl *placeholder = new objecthdl();
+	placeholder->bound = vec6f(-0.5, 0.5, -0.5, 0.5, -0.5, 0.5);
+	objects.push_back(placeholder);
+
+	loading.push_back(loadhdl());
+	loading.back().placeholder = placeholder;
+	loading.back().result = async(launch::async, [filename]() {
+		return (objecthdl*)new modelhdl(filename);
+	});
+}
+
+/* update_loading
+ *
+ * Swap any models that have finished loading in for their placeholders.
+ * This has to be called from the main loop because the first draw of
+ * the new model is what uploads it to the GPU. Returns true if the scene
+ * changed.
+ */
+bool scenehdl::update_loading()
+{
+	bool changed = false;
+	for (unsigned int i = 0; i < loading.size(); )
+	{
+		if (loading[i].result.wait_for(chrono::seconds(0)) != future_status::ready)
+		{
+			i++;
+			continue;
+		}
+
+		objecthdl *model = loading[i].result.get();
+		objecthdl *placeholder = loading[i].placeholder;
+		loading.erase(loading.begin() + i);
+
+		// The placeholder may have been deleted while the model loaded
+		vector<objecthdl*>::iterator slot = find(objects.begin(), objects.end(), placeholder);
+		if (placeholder == NULL || slot == objects.end())
+		{
+			delete model;
+			continue;
+		}
+
+		model->position = placeholder->position;
+		model->orientation = placeholder->orientation;
+		model->scale = placeholder->scale;
+		*slot = model;
+
+		// Take the placeholder's place in the scene graph.
+		if (placeholder->parent != NULL)
+			placeholder->parent->attach(model);
+		while (placeholder->children.size() > 0)
+			model->attach(placeholder->children.back());
+
+		for (unsigned int j = 0; j < cameras.size(); j++)
+			if (cameras[j] != NULL && cameras[j]->focus == placeholder)
+				cameras[j]->focus = model;
+
+		delete placeholder;
+		changed = true;
+	}
+
+	return changed;
+}
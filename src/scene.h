@@ -6,6 +6,9 @@
  */
 
 #include "opengl.h"
+#include "queue.h"
+#include "tree.h"
+#include <future>
 
 #ifndef scene_h
 #define scene_h
@@ -14,6 +17,15 @@ struct objecthdl;
 struct lighthdl;
 struct camerahdl;
 
+/* A model that is being loaded on a worker thread. The
+ * placeholder stands in for it in the scene until it is done.
+ */
+struct loadhdl
+{
+	objecthdl *placeholder;
+	future<objecthdl*> result;
+};
+
 struct scenehdl
 {
 	scenehdl();
@@ -22,6 +34,7 @@ struct scenehdl
 	vector<objecthdl*> objects;
 	vector<lighthdl*> lights;
 	vector<camerahdl*> cameras;
+	vector<loadhdl> loading;
 
 	int active_camera;
 	int active_object;
@@ -38,8 +51,35 @@ struct scenehdl
 	bool render_lights;
 	bool render_cameras;
 
+	// How many objects the last draw() skipped because their
+	// bounds were outside of the view frustum.
+	int culled;
+
+	// The rigid bodies of the visible objects, sorted by state.
+	queuehdl queue;
+
+	// The world space bounds of the objects for culling and picking,
+	// with the object at each leaf as its item, and the object that
+	// owns each leaf. See update().
+	aabbtreehdl tree;
+	vector<objecthdl*> owners;
+
+	// How many objects is_shown() allows, counted by update().
+	int shown;
+
+	// The uniform buffer behind the lights block of the shaders,
+	// filled once per frame by draw().
+	GLuint light_buffer;
+
+	void update();
+	vector<int> visible(const mat4f &view_projection);
 	void draw();
+	void upload_lights();
+
+	void load(string filename);
+	bool update_loading();
 
+	bool is_shown(int i);
 	bool active_camera_valid();
 	bool active_object_valid();
 
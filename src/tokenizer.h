@@ -0,0 +1,203 @@
+/*
+ * tokenizer.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "standard.h"
+#include <stdlib.h>
+
+#ifndef tokenizer_h
+#define tokenizer_h
+
+/* These parse a value starting at 'ptr' without reading
+ * past 'end'. On success, 'ptr' is moved past the value.
+ * On failure, 'ptr' is left untouched.
+ *
+ * parse_int accepts the same input as sscanf's %d and
+ * parse_float accepts the same input as operator>>(float&).
+ * Values that fit in a float mantissa with a small decimal
+ * exponent are converted with a single correctly rounded
+ * multiply or divide, everything else falls back to strtof,
+ * so both paths give bit-identical results to the stream.
+ */
+inline bool parse_int(const char *&ptr, const char *end, int &value)
+{
+	const char *curr = ptr;
+	bool negative = false;
+	if (curr < end && (*curr == '-' || *curr == '+'))
+		negative = (*curr++ == '-');
+
+	if (curr >= end || *curr < '0' || *curr > '9')
+		return false;
+
+	int result = 0;
+	while (curr < end && *curr >= '0' && *curr <= '9')
+		result = result*10 + (*curr++ - '0');
+
+	value = negative ? -result : result;
+	ptr = curr;
+	return true;
+}
+
+inline bool parse_float(const char *&ptr, const char *end, float &value)
+{
+	static const float powers[11] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+	const char *curr = ptr;
+	bool negative = false;
+	if (curr < end && (*curr == '-' || *curr == '+'))
+		negative = (*curr++ == '-');
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int significant = 0;
+	int exponent = 0;
+
+	while (curr < end && *curr >= '0' && *curr <= '9')
+	{
+		if (mantissa > 0 || *curr != '0')
+		{
+			if (significant < 19)
+				mantissa = mantissa*10 + (*curr - '0');
+			else
+				exponent++;
+			significant++;
+		}
+		digits++;
+		curr++;
+	}
+
+	if (curr < end && *curr == '.')
+	{
+		curr++;
+		while (curr < end && *curr >= '0' && *curr <= '9')
+		{
+			if (mantissa > 0 || *curr != '0')
+			{
+				if (significant < 19)
+				{
+					mantissa = mantissa*10 + (*curr - '0');
+					exponent--;
+				}
+				significant++;
+			}
+			else
+				exponent--;
+			digits++;
+			curr++;
+		}
+	}
+
+	if (digits == 0)
+		return false;
+
+	if (curr < end && (*curr == 'e' || *curr == 'E'))
+	{
+		curr++;
+		int e = 0;
+		if (!parse_int(curr, end, e))
+			return false;
+		exponent += e;
+	}
+
+	if (significant <= 19 && mantissa <= (1ull << 24) && exponent >= -10 && exponent <= 10)
+	{
+		float result = (float)mantissa;
+		if (exponent < 0)
+			result /= powers[-exponent];
+		else
+			result *= powers[exponent];
+		value = negative ? -result : result;
+	}
+	else
+	{
+		char buffer[64];
+		size_t length = curr - ptr;
+		if (length < sizeof(buffer))
+		{
+			memcpy(buffer, ptr, length);
+			buffer[length] = '\0';
+			value = strtof(buffer, NULL);
+		}
+		else
+			value = strtof(string(ptr, curr).c_str(), NULL);
+	}
+
+	ptr = curr;
+	return true;
+}
+
+/* This walks a block of text in place, one line at a time
+ * and one whitespace separated token at a time. None of its
+ * operations allocate memory.
+ */
+struct tokenizerhdl
+{
+	tokenizerhdl(const char *begin, const char *end)
+	{
+		this->ptr = begin;
+		this->end = end;
+	}
+
+	~tokenizerhdl()
+	{
+	}
+
+	const char *ptr;
+	const char *end;
+
+	bool done() const
+	{
+		return ptr >= end;
+	}
+
+	// Skip spaces and tabs, but not the end of the line.
+	void skip_space()
+	{
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\v' || *ptr == '\f'))
+			ptr++;
+	}
+
+	// Move to the start of the next line.
+	void skip_line()
+	{
+		const char *newline = (const char*)memchr(ptr, '\n', end - ptr);
+		ptr = (newline == NULL ? end : newline + 1);
+	}
+
+	// Get the next token on the current line.
+	bool token(const char *&token_begin, const char *&token_end)
+	{
+		skip_space();
+		if (ptr >= end || *ptr == '\n')
+			return false;
+
+		token_begin = ptr;
+		while (ptr < end && *ptr != ' ' && *ptr != '\t' && *ptr != '\r' && *ptr != '\v' && *ptr != '\f' && *ptr != '\n')
+			ptr++;
+		token_end = ptr;
+		return true;
+	}
+
+	bool read(float &value)
+	{
+		skip_space();
+		return parse_float(ptr, end, value);
+	}
+
+	bool read(int &value)
+	{
+		skip_space();
+		return parse_int(ptr, end, value);
+	}
+};
+
+inline bool token_equals(const char *begin, const char *end, const char *str)
+{
+	size_t length = strlen(str);
+	return (size_t)(end - begin) == length && memcmp(begin, str, length) == 0;
+}
+
+#endif
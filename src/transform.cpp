@@ -0,0 +1,196 @@
+/*
+ * transform.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "transform.h"
+#include "bvh.h"
+
+transformhdl::transformhdl()
+{
+	position = vec3f(0.0, 0.0, 0.0);
+	orientation = vec3f(0.0, 0.0, 0.0);
+	scale = 1.0;
+	parent = NULL;
+	local_valid = false;
+	dirty = true;
+	version = 0;
+	world = identity<float, 4, 4>();
+}
+
+/* A copy starts out detached from the scene graph. */
+transformhdl::transformhdl(const transformhdl &t)
+{
+	position = t.position;
+	orientation = t.orientation;
+	scale = t.scale;
+	parent = NULL;
+	local_valid = false;
+	dirty = true;
+	version = 0;
+	world = identity<float, 4, 4>();
+}
+
+transformhdl::~transformhdl()
+{
+	detach();
+	for (unsigned int i = 0; i < children.size(); i++)
+	{
+		children[i]->parent = NULL;
+		children[i]->dirty = true;
+	}
+	children.clear();
+}
+
+/* operator=
+ *
+ * Copy the placement, but not the place in the scene graph.
+ */
+transformhdl &transformhdl::operator=(const transformhdl &t)
+{
+	position = t.position;
+	orientation = t.orientation;
+	scale = t.scale;
+	return *this;
+}
+
+/* attach
+ *
+ * Make 'child' move along with this node. Its position,
+ * orientation, and scale become relative to this node.
+ * Nothing happens if 'child' is this node or one of its
+ * ancestors, since that would make a cycle.
+ */
+void transformhdl::attach(transformhdl *child)
+{
+	if (child == NULL || child->parent == this)
+		return;
+
+	for (transformhdl *node = this; node != NULL; node = node->parent)
+		if (node == child)
+			return;
+
+	child->detach();
+	child->parent = this;
+	child->dirty = true;
+	children.push_back(child);
+}
+
+/* detach
+ *
+ * Remove this node from its parent, leaving its position,
+ * orientation, and scale relative to the world.
+ */
+void transformhdl::detach()
+{
+	if (parent != NULL)
+	{
+		vector<transformhdl*>::iterator i = find(parent->children.begin(), parent->children.end(), this);
+		if (i != parent->children.end())
+			parent->children.erase(i);
+		parent = NULL;
+		dirty = true;
+	}
+}
+
+/* matrix
+ *
+ * Get the object to parent space matrix in row major order,
+ * rebuilding it if the position, orientation, or scale has
+ * changed since it was last built.
+ */
+const mat4f &transformhdl::matrix()
+{
+	if (!local_valid || position != local_position || orientation != local_orientation || scale != local_scale)
+	{
+		// The columns of the rotation are where it takes each axis.
+		vec3f x = rol3(vec3f(1.0, 0.0, 0.0), orientation)*scale;
+		vec3f y = rol3(vec3f(0.0, 1.0, 0.0), orientation)*scale;
+		vec3f z = rol3(vec3f(0.0, 0.0, 1.0), orientation)*scale;
+
+		local = identity<float, 4, 4>();
+		for (int i = 0; i < 3; i++)
+		{
+			local[i][0] = x[i];
+			local[i][1] = y[i];
+			local[i][2] = z[i];
+			local[i][3] = position[i];
+		}
+
+		local_position = position;
+		local_orientation = orientation;
+		local_scale = scale;
+		local_valid = true;
+		dirty = true;
+	}
+
+	return local;
+}
+
+/* update
+ *
+ * Bring the world matrices of this node and everything below it up
+ * to date, given that the parent's is. 'moved' says that the parent's
+ * world matrix was just rebuilt. Call this on the roots of the graph
+ * once a frame, see scenehdl::update().
+ */
+void transformhdl::update(bool moved)
+{
+	matrix();
+	if (dirty || moved)
+	{
+		if (parent == NULL)
+			world = local;
+		else
+			world = parent->world*local;
+		version++;
+		dirty = false;
+		moved = true;
+	}
+
+	for (unsigned int i = 0; i < children.size(); i++)
+		children[i]->update(moved);
+}
+
+/* world_matrix
+ *
+ * Get the object to world space matrix in row major order as of the
+ * last update().
+ */
+const mat4f &transformhdl::world_matrix()
+{
+	return world;
+}
+
+/* world_inverse
+ *
+ * Get the world to object space matrix, or the identity if the
+ * object is scaled down to a point. See affine_inverse().
+ */
+mat4f transformhdl::world_inverse()
+{
+	mat4f result;
+	affine_inverse(world, result);
+	return result;
+}
+
+/* push
+ *
+ * Save the modelview matrix and move it into object space.
+ */
+void transformhdl::push()
+{
+	glPushMatrix();
+	glMultTransposeMatrixf((const float*)world_matrix().data);
+}
+
+/* pop
+ *
+ * Restore the modelview matrix saved by push().
+ */
+void transformhdl::pop()
+{
+	glPopMatrix();
+}
@@ -0,0 +1,74 @@
+/*
+ * transform.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include "opengl.h"
+
+using namespace core;
+
+#ifndef transform_h
+#define transform_h
+
+/* This places something relative to its parent, or to the
+ * world if it doesn't have one, by a translation, a set of
+ * euler angles applied around x, then y, then z, and a uniform
+ * scale. Attaching nodes to each other makes a scene graph, and
+ * a node moves along with everything above it.
+ *
+ * Both the local and the world matrix are cached. The world
+ * matrices are brought up to date once a frame by update(), which
+ * goes down the graph from each root. A node whose position,
+ * orientation, or scale changed, or that was attached or detached,
+ * rebuilds its world matrix along with everything below it, and
+ * the rest of the graph is only checked, so the work grows with
+ * what moved rather than with the depth of the graph.
+ */
+struct transformhdl
+{
+	transformhdl();
+	transformhdl(const transformhdl &t);
+	virtual ~transformhdl();
+
+	vec3f position;
+	vec3f orientation;
+	float scale;
+
+	transformhdl *parent;
+	vector<transformhdl*> children;
+
+	transformhdl &operator=(const transformhdl &t);
+
+	void attach(transformhdl *child);
+	void detach();
+
+	const mat4f &matrix();
+	void update(bool moved = false);
+	const mat4f &world_matrix();
+	mat4f world_inverse();
+	void push();
+	void pop();
+
+protected:
+	// The values that 'local' was last built from.
+	vec3f local_position;
+	vec3f local_orientation;
+	float local_scale;
+	bool local_valid;
+	mat4f local;
+
+	// 'world' is parent_world*local as of the last update(). It
+	// counts how many times it has been rebuilt in 'version' so that
+	// the things derived from it can tell when they are out of date.
+	// 'dirty' is set when it has to be rebuilt along with the whole
+	// subtree below it.
+	bool dirty;
+	unsigned int version;
+	mat4f world;
+};
+
+#endif
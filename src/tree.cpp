@@ -0,0 +1,445 @@
+/*
+ * tree.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "tree.h"
+
+/* merge
+ *
+ * Find the smallest box around both 'a' and 'b'.
+ */
+static vec6f merge(const vec6f &a, const vec6f &b)
+{
+	return vec6f(min(a[0], b[0]), max(a[1], b[1]), min(a[2], b[2]), max(a[3], b[3]), min(a[4], b[4]), max(a[5], b[5]));
+}
+
+/* area
+ *
+ * Get half of the surface area of a box, which is all that the costs
+ * of the tree ever compare.
+ */
+static float area(const vec6f &b)
+{
+	float x = b[1] - b[0], y = b[3] - b[2], z = b[5] - b[4];
+	return x*y + y*z + z*x;
+}
+
+static bool contains(const vec6f &a, const vec6f &b)
+{
+	return a[0] <= b[0] && b[1] <= a[1] && a[2] <= b[2] && b[3] <= a[3] && a[4] <= b[4] && b[5] <= a[5];
+}
+
+static bool overlaps(const vec6f &a, const vec6f &b)
+{
+	return a[0] <= b[1] && b[0] <= a[1] && a[2] <= b[3] && b[2] <= a[3] && a[4] <= b[5] && b[4] <= a[5];
+}
+
+/* slab
+ *
+ * Find where a ray enters the box 'b', given one over each component
+ * of its direction, or return a number past 't' if it misses the box
+ * or only reaches it after 't'.
+ */
+static float slab(const vec6f &b, const vec3f &origin, const vec3f &inverse, float t)
+{
+	float near = 0.0f, far = t;
+	for (int j = 0; j < 3; j++)
+	{
+		float t0 = (b[2*j] - origin[j])*inverse[j];
+		float t1 = (b[2*j+1] - origin[j])*inverse[j];
+		near = max(near, min(t0, t1));
+		far = min(far, max(t0, t1));
+	}
+	return (near <= far ? near : 2.0f*t + 1.0f);
+}
+
+aabbtreehdl::aabbtreehdl()
+{
+	root = -1;
+	free_list = -1;
+	leaves = 0;
+	margin = 0.1f;
+}
+
+aabbtreehdl::~aabbtreehdl()
+{
+}
+
+int aabbtreehdl::allocate()
+{
+	int node = free_list;
+	if (node >= 0)
+		free_list = nodes[node].parent;
+	else
+	{
+		node = (int)nodes.size();
+		nodes.push_back(aabbnodehdl());
+	}
+
+	nodes[node].parent = -1;
+	nodes[node].children[0] = -1;
+	nodes[node].children[1] = -1;
+	nodes[node].height = 0;
+	nodes[node].item = -1;
+	return node;
+}
+
+void aabbtreehdl::release(int node)
+{
+	nodes[node].height = -1;
+	nodes[node].parent = free_list;
+	free_list = node;
+}
+
+/* insert
+ *
+ * Add an item with the box 'bound' and return its proxy.
+ */
+int aabbtreehdl::insert(const vec6f &bound, int item)
+{
+	float size = max(bound[1] - bound[0], max(bound[3] - bound[2], bound[5] - bound[4]));
+	float d = margin*size;
+
+	int leaf = allocate();
+	nodes[leaf].bound = vec6f(bound[0] - d, bound[1] + d, bound[2] - d, bound[3] + d, bound[4] - d, bound[5] + d);
+	nodes[leaf].item = item;
+	insert_leaf(leaf);
+	leaves++;
+	return leaf;
+}
+
+void aabbtreehdl::remove(int proxy)
+{
+	remove_leaf(proxy);
+	release(proxy);
+	leaves--;
+}
+
+/* move
+ *
+ * Give the item at 'proxy' the new box 'bound'. Nothing changes while
+ * it still fits inside the fattened box of its leaf, unless it has
+ * shrunk to much less than that box. Returns true if the leaf was
+ * moved.
+ */
+bool aabbtreehdl::move(int proxy, const vec6f &bound)
+{
+	float size = max(bound[1] - bound[0], max(bound[3] - bound[2], bound[5] - bound[4]));
+	float d = margin*size;
+	vec6f fat(bound[0] - d, bound[1] + d, bound[2] - d, bound[3] + d, bound[4] - d, bound[5] + d);
+
+	if (contains(nodes[proxy].bound, bound) && area(nodes[proxy].bound) <= 4.0f*area(fat))
+		return false;
+
+	remove_leaf(proxy);
+	nodes[proxy].bound = fat;
+	insert_leaf(proxy);
+	return true;
+}
+
+void aabbtreehdl::clear()
+{
+	nodes.clear();
+	root = -1;
+	free_list = -1;
+	leaves = 0;
+}
+
+/* insert_leaf
+ *
+ * Find the sibling for 'leaf' that adds the least surface area to
+ * the tree, going down from the root, and pair them up under a new
+ * parent.
+ */
+void aabbtreehdl::insert_leaf(int leaf)
+{
+	if (root < 0)
+	{
+		root = leaf;
+		nodes[leaf].parent = -1;
+		return;
+	}
+
+	vec6f bound = nodes[leaf].bound;
+	int index = root;
+	while (nodes[index].height > 0)
+	{
+		float combined = area(merge(nodes[index].bound, bound));
+
+		// Making a new parent for this node and the leaf, or the
+		// extra area that every parent above a child would gain
+		float cost = 2.0f*combined;
+		float inherited = 2.0f*(combined - area(nodes[index].bound));
+
+		float child_cost[2];
+		for (int i = 0; i < 2; i++)
+		{
+			const aabbnodehdl &child = nodes[nodes[index].children[i]];
+			child_cost[i] = area(merge(child.bound, bound)) + inherited;
+			if (child.height > 0)
+				child_cost[i] -= area(child.bound);
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+			break;
+
+		index = nodes[index].children[child_cost[0] < child_cost[1] ? 0 : 1];
+	}
+
+	int sibling = index;
+	int old_parent = nodes[sibling].parent;
+	int parent = allocate();
+	nodes[parent].parent = old_parent;
+	nodes[parent].bound = merge(nodes[sibling].bound, bound);
+	nodes[parent].height = nodes[sibling].height + 1;
+	nodes[parent].children[0] = sibling;
+	nodes[parent].children[1] = leaf;
+	nodes[sibling].parent = parent;
+	nodes[leaf].parent = parent;
+
+	if (old_parent < 0)
+		root = parent;
+	else if (nodes[old_parent].children[0] == sibling)
+		nodes[old_parent].children[0] = parent;
+	else
+		nodes[old_parent].children[1] = parent;
+
+	refit(parent);
+}
+
+/* remove_leaf
+ *
+ * Take 'leaf' out of the tree, putting its sibling in the place of
+ * their parent. The leaf itself isn't released.
+ */
+void aabbtreehdl::remove_leaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grandparent = nodes[parent].parent;
+	int sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+
+	nodes[sibling].parent = grandparent;
+	if (grandparent < 0)
+		root = sibling;
+	else
+	{
+		if (nodes[grandparent].children[0] == parent)
+			nodes[grandparent].children[0] = sibling;
+		else
+			nodes[grandparent].children[1] = sibling;
+	}
+
+	release(parent);
+	refit(grandparent);
+}
+
+/* refit
+ *
+ * Balance 'node' and every node above it, and update their heights
+ * and boxes.
+ */
+void aabbtreehdl::refit(int node)
+{
+	while (node >= 0)
+	{
+		node = balance(node);
+
+		aabbnodehdl &n = nodes[node];
+		const aabbnodehdl &a = nodes[n.children[0]];
+		const aabbnodehdl &b = nodes[n.children[1]];
+		n.height = 1 + max(a.height, b.height);
+		n.bound = merge(a.bound, b.bound);
+		node = n.parent;
+	}
+}
+
+/* balance
+ *
+ * If one child of 'node' is more than one level taller than the
+ * other, rotate the taller child up into the place of 'node'. The
+ * taller of its children stays with it and the other one takes its
+ * place under 'node'. Returns the node that ends up in this spot.
+ */
+int aabbtreehdl::balance(int node)
+{
+	if (nodes[node].height < 2)
+		return node;
+
+	int diff = nodes[nodes[node].children[1]].height - nodes[nodes[node].children[0]].height;
+	if (diff >= -1 && diff <= 1)
+		return node;
+
+	int side = (diff > 1 ? 1 : 0);
+	int up = nodes[node].children[side];
+	int other = nodes[node].children[1-side];
+	int taller = nodes[up].children[0];
+	int shorter = nodes[up].children[1];
+	if (nodes[taller].height < nodes[shorter].height)
+		swap(taller, shorter);
+
+	int parent = nodes[node].parent;
+	nodes[up].parent = parent;
+	if (parent < 0)
+		root = up;
+	else if (nodes[parent].children[0] == node)
+		nodes[parent].children[0] = up;
+	else
+		nodes[parent].children[1] = up;
+
+	nodes[up].children[0] = node;
+	nodes[up].children[1] = taller;
+	nodes[node].parent = up;
+	nodes[node].children[side] = shorter;
+	nodes[shorter].parent = node;
+
+	nodes[node].bound = merge(nodes[other].bound, nodes[shorter].bound);
+	nodes[node].height = 1 + max(nodes[other].height, nodes[shorter].height);
+	nodes[up].bound = merge(nodes[node].bound, nodes[taller].bound);
+	nodes[up].height = 1 + max(nodes[node].height, nodes[taller].height);
+	return up;
+}
+
+/* query
+ *
+ * Call visit(item) for every item whose fattened box overlaps 'box'.
+ */
+void aabbtreehdl::query(const vec6f &box, const function<void(int)> &visit) const
+{
+	if (root < 0)
+		return;
+
+	vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(root);
+	while (stack.size() > 0)
+	{
+		const aabbnodehdl &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!overlaps(node.bound, box))
+			continue;
+
+		if (node.height == 0)
+			visit(node.item);
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+}
+
+/* query
+ *
+ * Call visit(item, inside) for every item whose fattened box might be
+ * in the view frustum, given the camera's projection times view
+ * matrix. 'inside' is true if the fattened box is entirely inside,
+ * otherwise the item needs a closer look. The planes are found the
+ * same way as in objecthdl::in_frustum.
+ */
+void aabbtreehdl::query(const mat4f &view_projection, const function<void(int, bool)> &visit) const
+{
+	if (root < 0)
+		return;
+
+	float planes[6][4];
+	for (int i = 0; i < 3; i++)
+		for (int side = 0; side < 2; side++)
+			for (int j = 0; j < 4; j++)
+				planes[i*2 + side][j] = view_projection[3][j] - (side == 0 ? -1.0f : 1.0f)*view_projection[i][j];
+
+	// Nodes are pushed as node*2 + inside so that the nodes under one
+	// that is entirely inside aren't tested again.
+	vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(root*2);
+	while (stack.size() > 0)
+	{
+		int entry = stack.back();
+		stack.pop_back();
+		const aabbnodehdl &node = nodes[entry/2];
+		bool inside = ((entry&1) != 0);
+
+		if (!inside)
+		{
+			const vec6f &b = node.bound;
+			vec3f center((b[0] + b[1])*0.5f, (b[2] + b[3])*0.5f, (b[4] + b[5])*0.5f);
+			vec3f half((b[1] - b[0])*0.5f, (b[3] - b[2])*0.5f, (b[5] - b[4])*0.5f);
+
+			bool outside = false;
+			inside = true;
+			for (int i = 0; i < 6 && !outside; i++)
+			{
+				float distance = planes[i][0]*center[0] + planes[i][1]*center[1] + planes[i][2]*center[2] + planes[i][3];
+				float extent = fabs(planes[i][0])*half[0] + fabs(planes[i][1])*half[1] + fabs(planes[i][2])*half[2];
+				outside = (distance + extent < 0.0f);
+				inside = inside && (distance - extent >= 0.0f);
+			}
+
+			if (outside)
+				continue;
+		}
+
+		if (node.height == 0)
+			visit(node.item, inside);
+		else
+		{
+			stack.push_back(node.children[0]*2 + (inside ? 1 : 0));
+			stack.push_back(node.children[1]*2 + (inside ? 1 : 0));
+		}
+	}
+}
+
+/* raycast
+ *
+ * Call visit(item, t) for every item whose fattened box the ray from
+ * 'origin' along 'direction' reaches before 't', nearest boxes
+ * first. The visitor returns the new end of the ray, the distance to
+ * the nearest hit so far, which prunes the rest of the search.
+ */
+void aabbtreehdl::raycast(const vec3f &origin, const vec3f &direction, float t, const function<float(int, float)> &visit) const
+{
+	if (root < 0)
+		return;
+
+	vec3f inverse;
+	for (int j = 0; j < 3; j++)
+	{
+		float d = direction[j];
+		if (fabs(d) < 1.0e-20f)
+			d = (d < 0.0f ? -1.0e-20f : 1.0e-20f);
+		inverse[j] = 1.0f/d;
+	}
+
+	vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(root);
+	while (stack.size() > 0)
+	{
+		const aabbnodehdl &node = nodes[stack.back()];
+		stack.pop_back();
+		if (slab(node.bound, origin, inverse, t) > t)
+			continue;
+
+		if (node.height == 0)
+			t = min(t, visit(node.item, t));
+		else
+		{
+			int near = node.children[0];
+			int far = node.children[1];
+			if (slab(nodes[near].bound, origin, inverse, t) > slab(nodes[far].bound, origin, inverse, t))
+				swap(near, far);
+
+			stack.push_back(far);
+			stack.push_back(near);
+		}
+	}
+}
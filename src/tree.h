@@ -0,0 +1,74 @@
+/*
+ * tree.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: nbingham
+ */
+
+#include "core/geometry.h"
+#include "standard.h"
+#include <functional>
+
+using namespace core;
+
+#ifndef tree_h
+#define tree_h
+
+/* A node of aabbtreehdl. Leaves have no children and hold 'item',
+ * interior nodes always have two. 'height' is 0 for leaves and -1
+ * for nodes on the free list, which is threaded through 'parent'.
+ */
+struct aabbnodehdl
+{
+	vec6f bound;
+	int parent;
+	int children[2];
+	int height;
+	int item;
+};
+
+/* A bounding volume tree over boxes that move around, like the world
+ * space bounds of the objects in a scene, see scenehdl::update().
+ *
+ * Every leaf keeps a box that is fattened by 'margin' times its size
+ * on every side, so an item that moves a little still fits and the
+ * tree is left alone. Items that leave their box are taken out and
+ * inserted again where they add the least surface area, and the
+ * parents on the way up are rotated to keep the tree balanced, so
+ * each change only touches O(log n) nodes and the queries only visit
+ * the branches that they reach.
+ *
+ * Boxes are (left, right, bottom, top, front, back) like
+ * objecthdl::bound. Leaves are referred to by their index in 'nodes',
+ * called a proxy, which stays the same until the leaf is removed.
+ */
+struct aabbtreehdl
+{
+	aabbtreehdl();
+	~aabbtreehdl();
+
+	vector<aabbnodehdl> nodes;
+	int root;
+	int free_list;
+	int leaves;
+	float margin;
+
+	int insert(const vec6f &bound, int item);
+	void remove(int proxy);
+	bool move(int proxy, const vec6f &bound);
+	void clear();
+
+	void query(const vec6f &box, const function<void(int)> &visit) const;
+	void query(const mat4f &view_projection, const function<void(int, bool)> &visit) const;
+	void raycast(const vec3f &origin, const vec3f &direction, float t, const function<float(int, float)> &visit) const;
+
+private:
+	int allocate();
+	void release(int node);
+	void insert_leaf(int leaf);
+	void remove_leaf(int leaf);
+	void refit(int node);
+	int balance(int node);
+};
+
+#endif